@@ -0,0 +1,113 @@
+// Request parsing microbenchmark: HttpParser over small, typical-browser,
+// 60-header and long-value requests, once per header scanning
+// implementation the CPU has.
+//
+//   cmake -S . -B build -DSOLDER_BUILD_BENCH=ON && cmake --build build --target parser_bench
+//   ./build/parser_bench [min_seconds_per_case]
+
+#include "solder/parser.hpp"
+#include "solder/picohttpparser.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Case {
+    const char* name;
+    std::string request;
+};
+
+std::vector<Case> make_cases() {
+    std::vector<Case> cases;
+
+    cases.push_back({"small", "GET /health HTTP/1.1\r\nHost: api.local\r\n\r\n"});
+
+    cases.push_back({"browser",
+        "GET /static/js/app.5f2c8e1a.js?v=20240611 HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/124.0.0.0 Safari/537.36\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Dest: script\r\n"
+        "Referer: https://www.example.com/dashboard/reports?range=30d\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Accept-Language: en-US,en;q=0.9,id;q=0.8\r\n"
+        "Cookie: session=7f3a9c0e5b2d4e6f8a1b3c5d7e9f0a2b; theme=dark; _ga=GA1.2.1234567890.1700000000\r\n"
+        "\r\n"});
+
+    std::string many = "GET /api/v1/items?page=2 HTTP/1.1\r\nHost: api.example.com\r\n";
+    for (int i = 1; i < 60; ++i) {
+        many += "X-Custom-Header-" + std::to_string(i) + ": value-" + std::to_string(i * 7919) +
+                "-abcdefghijklmnopqrstuvwxyz\r\n";
+    }
+    many += "\r\n";
+    cases.push_back({"60-headers", std::move(many)});
+
+    // Session cookies and bearer tokens, where the wide AVX2 scan pays off
+    cases.push_back({"long-values", "GET /me HTTP/1.1\r\nHost: api.example.com\r\nCookie: session=" + std::string(4000, 'c') +
+                                    "\r\nAuthorization: Bearer " + std::string(1200, 't') + "\r\n\r\n"});
+
+    return cases;
+}
+
+const char* level_name(int level) {
+    switch (level) {
+    case PHR_SIMD_AVX2: return "avx2";
+    case PHR_SIMD_SSE42: return "sse4.2";
+    default: return "scalar";
+    }
+}
+
+// Feeds the same request over and over and returns nanoseconds per request
+double run(const std::string& request, double min_seconds) {
+    using clock = std::chrono::steady_clock;
+    solder::HttpParser parser;
+    solder::Req req;
+    size_t iterations = 1024;
+    size_t total = 0;
+    double elapsed = 0;
+
+    while (elapsed < min_seconds) {
+        auto start = clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            parser.feed(request.data(), request.size());
+            if (parser.next(req) != solder::ParseStatus::Complete) {
+                std::fprintf(stderr, "parse failed\n");
+                std::exit(1);
+            }
+        }
+        elapsed += std::chrono::duration<double>(clock::now() - start).count();
+        total += iterations;
+        iterations *= 2;
+    }
+    return elapsed * 1e9 / total;
+}
+
+}
+
+int main(int argc, char** argv) {
+    double min_seconds = argc > 1 ? std::atof(argv[1]) : 0.5;
+    auto cases = make_cases();
+
+    std::printf("%-12s %-8s %8s %12s %10s\n", "case", "impl", "bytes", "ns/request", "MB/s");
+    for (const Case& c : cases) {
+        for (int level = PHR_SIMD_SCALAR; level <= PHR_SIMD_AVX2; ++level) {
+            if (phr_set_simd_level(level) != level) continue;
+            double ns = run(c.request, min_seconds);
+            std::printf("%-12s %-8s %8zu %12.1f %10.1f\n", c.name, level_name(level), c.request.size(), ns,
+                        c.request.size() / ns * 1e3);
+        }
+    }
+    phr_set_simd_level(PHR_SIMD_AVX2);
+    return 0;
+}
@@ -0,0 +1,321 @@
+#include "body_reader.hpp"
+#include <photon/common/alog.h>
+#include <photon/common/io-alloc.h>
+#include <photon/common/iovector.h>
+#include <zlib.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace solder {
+
+struct BodyReader::Inflater {
+    static constexpr size_t input_size = 16 * 1024;
+
+    z_stream stream = {};
+    std::unique_ptr<char[]> input{new char[input_size]};
+    size_t max_size;
+    size_t produced = 0;
+    bool ended = false;
+
+    ~Inflater() { inflateEnd(&stream); }
+};
+
+BodyReader::BodyReader(HttpParser& parser, photon::net::ISocketStream* stream)
+    : parser_(&parser), stream_(stream) {
+    parser_->begin_body();
+    chunked_ = parser_->body_chunked();
+    remaining_ = parser_->body_length();
+    decoder_.consume_trailer = 1;
+    done_ = !chunked_ && remaining_ == 0;
+}
+
+BodyReader::BodyReader(std::string_view body)
+    : parser_(nullptr), stream_(nullptr), buffered_(body), chunked_(false), remaining_(body.size()) {
+    done_ = remaining_ == 0;
+}
+
+BodyReader::~BodyReader() = default;
+
+bool BodyReader::decode(std::string_view content_encoding, size_t max_size) {
+    while (!content_encoding.empty() && content_encoding.back() == ' ') content_encoding.remove_suffix(1);
+    while (!content_encoding.empty() && content_encoding.front() == ' ') content_encoding.remove_prefix(1);
+
+    int window_bits;
+    if (iequals(content_encoding, "gzip") || iequals(content_encoding, "x-gzip")) {
+        window_bits = 16 + MAX_WBITS;
+    } else if (iequals(content_encoding, "deflate")) {
+        window_bits = MAX_WBITS;
+    } else {
+        return content_encoding.empty() || iequals(content_encoding, "identity");
+    }
+
+    auto inflater = std::make_unique<Inflater>();
+    if (inflateInit2(&inflater->stream, window_bits) != Z_OK) {
+        LOG_ERROR("inflateInit2 failed");
+        return false;
+    }
+    inflater->max_size = max_size;
+    inflater_ = std::move(inflater);
+    return true;
+}
+
+bool BodyReader::done() const {
+    return inflater_ ? inflater_->ended : done_;
+}
+
+ssize_t BodyReader::fill(void* buf, size_t count, bool& from_buffer) {
+    std::string_view buffered;
+    if (parser_) {
+        buffered = parser_->take_buffered(count);
+    } else {
+        buffered = buffered_.substr(0, count);
+        buffered_.remove_prefix(buffered.size());
+    }
+    if (!buffered.empty()) {
+        std::memcpy(buf, buffered.data(), buffered.size());
+        from_buffer = true;
+        return buffered.size();
+    }
+
+    from_buffer = false;
+    ssize_t ret = stream_->recv(buf, count);
+    if (ret <= 0) {
+        LOG_DEBUG("Connection ended inside a request body, errno: ", errno);
+        failed_ = true;
+        return -1;
+    }
+    return ret;
+}
+
+ssize_t BodyReader::read(void* buf, size_t count) {
+    return inflater_ ? inflate(buf, count) : read_raw(buf, count);
+}
+
+ssize_t BodyReader::read_raw(void* buf, size_t count) {
+    if (failed_) return -1;
+    if (done_ || count == 0) return 0;
+
+    bool from_buffer;
+    if (!chunked_) {
+        // Never read past Content-Length, so nothing has to be given back
+        ssize_t got = fill(buf, std::min(count, remaining_), from_buffer);
+        if (got < 0) return -1;
+        remaining_ -= got;
+        done_ = remaining_ == 0;
+        return got;
+    }
+
+    // Decode in the caller's buffer; a read that was all chunk framing
+    // yields nothing, so go on until there is data or the body ends
+    while (true) {
+        ssize_t got = fill(buf, count, from_buffer);
+        if (got < 0) return -1;
+
+        size_t size = got;
+        ssize_t ret = phr_decode_chunked(&decoder_, static_cast<char*>(buf), &size);
+        if (ret == -1) {
+            LOG_DEBUG("Malformed chunked request body");
+            failed_ = true;
+            return -1;
+        }
+        if (ret >= 0) {
+            done_ = true;
+            // The decoder left what follows the body right after the data
+            if (from_buffer) {
+                parser_->untake(ret);
+            } else {
+                leftover_.assign(static_cast<char*>(buf) + size, ret);
+            }
+        }
+        if (size > 0 || done_) {
+            return size;
+        }
+    }
+}
+
+ssize_t BodyReader::inflate(void* buf, size_t count) {
+    Inflater& z = *inflater_;
+    if (failed_) return -1;
+    if (z.ended || count == 0) return 0;
+
+    z.stream.next_out = static_cast<Bytef*>(buf);
+    z.stream.avail_out = std::min<size_t>(count, UINT_MAX);
+    size_t room = z.stream.avail_out;
+
+    // Inflate whatever has arrived; only go back to the socket when the
+    // input ran dry without producing anything
+    while (true) {
+        if (z.stream.avail_in == 0) {
+            ssize_t got = read_raw(z.input.get(), Inflater::input_size);
+            if (got < 0) return -1;
+            if (got == 0) {
+                LOG_DEBUG("Compressed request body ended early");
+                failed_ = true;
+                return -1;
+            }
+            z.stream.next_in = reinterpret_cast<Bytef*>(z.input.get());
+            z.stream.avail_in = got;
+        }
+
+        int ret = ::inflate(&z.stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            LOG_DEBUG("Malformed compressed request body: ", ret);
+            failed_ = true;
+            return -1;
+        }
+
+        size_t produced = room - z.stream.avail_out;
+        z.produced += produced;
+        if (z.produced > z.max_size) {
+            LOG_DEBUG("Decompressed request body over ", z.max_size, " bytes");
+            too_large_ = true;
+            failed_ = true;
+            return -1;
+        }
+        if (ret == Z_STREAM_END) {
+            z.ended = true;
+        }
+        if (produced > 0 || z.ended) {
+            return produced;
+        }
+    }
+}
+
+bool BodyReader::read_all(std::string& out) {
+    constexpr size_t step = 16 * 1024;
+    out.clear();
+    while (!done()) {
+        size_t size = out.size();
+        out.resize(size + step);
+        ssize_t got = read(out.data() + size, step);
+        if (got < 0) return false;
+        out.resize(size + got);
+    }
+    return true;
+}
+
+ssize_t BodyReader::readv(const iovec* iov, int iovcnt) {
+    if (inflater_ || chunked_ || !parser_ || parser_->has_buffered() || failed_ || done_ || iovcnt <= 1) {
+        return iovcnt > 0 ? read(iov[0].iov_base, iov[0].iov_len) : 0;
+    }
+
+    // Never read past Content-Length
+    iovec limited[8];
+    int count = 0;
+    size_t left = remaining_;
+    for (int i = 0; i < iovcnt && count < 8 && left > 0; ++i) {
+        size_t len = std::min(iov[i].iov_len, left);
+        limited[count++] = {iov[i].iov_base, len};
+        left -= len;
+    }
+
+    ssize_t ret = stream_->recv(limited, count);
+    if (ret <= 0) {
+        LOG_DEBUG("Connection ended inside a request body, errno: ", errno);
+        failed_ = true;
+        return -1;
+    }
+    remaining_ -= ret;
+    done_ = remaining_ == 0;
+    return ret;
+}
+
+bool BodyReader::finish() {
+    // Raw bytes, as anything after the end of a compressed stream is
+    // still part of the body
+    char scratch[4096];
+    while (!done_) {
+        if (read_raw(scratch, sizeof(scratch)) < 0) {
+            return false;
+        }
+    }
+    if (parser_) {
+        parser_->end_body(leftover_);
+    }
+    return true;
+}
+
+namespace {
+
+// Blocks are recycled per worker instead of going back to malloc
+IOAlloc block_alloc() {
+    static thread_local PooledAllocator<BodyChain::block_size, 64> pool;
+    return pool.get_io_alloc();
+}
+
+}
+
+BodyChain::BodyChain(size_t max_size) : max_size_(max_size) {
+    size_t blocks = std::min<size_t>(max_size / block_size + 2, UINT16_MAX - 1);
+    iov_ = new_iovector(blocks, 0);
+    new (iov_->get_allocator()) IOAlloc(block_alloc());
+}
+
+BodyChain::BodyChain(std::string_view body) : max_size_(body.size()), size_(body.size()) {
+    iov_ = new_iovector(1, 0);
+    new (iov_->get_allocator()) IOAlloc();
+    if (!body.empty()) {
+        iov_->push_back(const_cast<char*>(body.data()), body.size());
+    }
+    allocated_ = size_;
+}
+
+BodyChain::~BodyChain() {
+    delete_iovector(iov_);
+}
+
+bool BodyChain::read_from(BodyReader& reader) {
+    // Blocks filled by a single recv()
+    constexpr size_t batch = 4;
+
+    if (!reader.chunked() && !reader.decoding() && reader.remaining() > max_size_) {
+        too_large_ = true;
+        return false;
+    }
+
+    while (!reader.done()) {
+        // One block past max_size_ lets a body of exactly max_size_ bytes
+        // finish; anything that spills into it is refused below
+        while (allocated_ - size_ < batch * block_size && allocated_ <= max_size_ &&
+               iov_->back_free_iovcnt() > 0) {
+            if (iov_->push_back(block_size) != block_size) {
+                LOG_ERROR("Failed to allocate a request body block");
+                return false;
+            }
+            allocated_ += block_size;
+        }
+        if (size_ > max_size_ || size_ == allocated_) {
+            too_large_ = true;
+            return false;
+        }
+
+        // Every block is full size, so the free space starts in the block
+        // size_ points into and runs through the following ones
+        iovec space[batch + 1];
+        int count = 0;
+        size_t index = size_ / block_size;
+        size_t offset = size_ % block_size;
+        for (; index < iov_->iovcnt() && count < static_cast<int>(batch + 1); ++index, offset = 0) {
+            const iovec& block = (*iov_)[index];
+            space[count++] = {static_cast<char*>(block.iov_base) + offset, block.iov_len - offset};
+        }
+
+        ssize_t got = reader.readv(space, count);
+        if (got < 0) {
+            too_large_ = reader.too_large();
+            return false;
+        }
+        size_ += got;
+    }
+
+    if (size_ > max_size_) {
+        too_large_ = true;
+        return false;
+    }
+    // Unused blocks stay owned by the chain until it is destroyed
+    iov_->shrink_to(size_);
+    return true;
+}
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "parser.hpp"
+#include <photon/net/socket.h>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+
+class iovector;
+
+namespace solder {
+
+// Pulls a request body as it arrives: first whatever the parser already
+// buffered, then straight from the socket into the caller's memory.
+// Chunked bodies come out decoded. Handlers of routes registered with
+// RouteOptions::stream_body get one through Req::body_reader.
+class BodyReader {
+public:
+    BodyReader(HttpParser& parser, photon::net::ISocketStream* stream);
+    // Over a body that was buffered whole before the route was known
+    explicit BodyReader(std::string_view body);
+    ~BodyReader();
+
+    // Inflate a gzip or deflate Content-Encoding while reading, so nothing
+    // waits for the whole compressed body. Reading fails once more than
+    // `max_size` bytes come out. Returns false for codings it cannot undo.
+    bool decode(std::string_view content_encoding, size_t max_size);
+
+    // Reads up to `count` body bytes. Returns 0 once the body is complete
+    // and -1 on a socket or framing error.
+    ssize_t read(void* buf, size_t count);
+    // Same, but a Content-Length body is received with one recv() spanning
+    // all of `iov` once the parser's buffered bytes are used up
+    ssize_t readv(const iovec* iov, int iovcnt);
+    // Reads the rest of the body into `out`, replacing its contents
+    bool read_all(std::string& out);
+
+    bool done() const;
+    bool chunked() const { return chunked_; }
+    bool decoding() const { return inflater_ != nullptr; }
+    // Bytes still to come as sent; only meaningful for Content-Length bodies
+    size_t remaining() const { return remaining_; }
+    // Whether reading failed on the decoded size limit
+    bool too_large() const { return too_large_; }
+
+    // Skips whatever the handler left unread and hands the connection back
+    // to the parser. Returns false if the connection cannot be reused.
+    bool finish();
+
+private:
+    HttpParser* parser_;
+    photon::net::ISocketStream* stream_;
+    std::string_view buffered_;
+    bool chunked_;
+    size_t remaining_;
+    phr_chunked_decoder decoder_ = {};
+    bool done_ = false;
+    bool failed_ = false;
+    bool too_large_ = false;
+    std::string leftover_;
+
+    struct Inflater;
+    std::unique_ptr<Inflater> inflater_;
+
+    ssize_t fill(void* buf, size_t count, bool& from_buffer);
+    ssize_t read_raw(void* buf, size_t count);
+    ssize_t inflate(void* buf, size_t count);
+};
+
+// A whole request body kept in fixed-size blocks from a per-worker pool,
+// received from the socket with one recv() over several blocks at a time.
+// Handlers that pass the body on to a file or socket never need it
+// contiguous, so it is never copied into one piece.
+class BodyChain {
+public:
+    static constexpr size_t block_size = 64 * 1024;
+
+    // Room for bodies up to `max_size` bytes
+    explicit BodyChain(size_t max_size);
+    // Borrows a body that was buffered whole; nothing is allocated
+    explicit BodyChain(std::string_view body);
+    ~BodyChain();
+
+    BodyChain(const BodyChain&) = delete;
+    BodyChain& operator=(const BodyChain&) = delete;
+
+    // Reads until the body ends. Returns false on a socket or framing
+    // error, or when the body is over max_size (see too_large()).
+    bool read_from(BodyReader& reader);
+    bool too_large() const { return too_large_; }
+
+    const iovector& data() const { return *iov_; }
+    size_t size() const { return size_; }
+
+private:
+    iovector* iov_;
+    size_t max_size_;
+    size_t allocated_ = 0;
+    size_t size_ = 0;
+    bool too_large_ = false;
+};
+
+}
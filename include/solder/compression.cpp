@@ -0,0 +1,223 @@
+#include "compression.hpp"
+#include <photon/common/alog.h>
+#include <zlib.h>
+#include <climits>
+
+namespace solder {
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// q-value of one Accept-Encoding item in thousandths; a malformed one
+// counts as 0
+int quality(std::string_view params) {
+    auto q = params.find("q=");
+    if (q == std::string_view::npos) return 1000;
+    std::string_view value = trim(params.substr(q + 2));
+    if (value.empty() || (value[0] != '0' && value[0] != '1')) return 0;
+    if (value[0] == '1') return 1000;
+    int result = 0;
+    int scale = 100;
+    for (size_t i = 2; i < value.size() && i < 5; ++i) {
+        if (value[i] < '0' || value[i] > '9') break;
+        result += (value[i] - '0') * scale;
+        scale /= 10;
+    }
+    return result;
+}
+
+}
+
+ContentCoding negotiate_coding(std::string_view accept_encoding) {
+    int gzip = -1;
+    int deflate = -1;
+    int any = -1;
+
+    while (!accept_encoding.empty()) {
+        auto comma = accept_encoding.find(',');
+        std::string_view item = accept_encoding.substr(0, comma);
+        accept_encoding = comma == std::string_view::npos ? std::string_view{} : accept_encoding.substr(comma + 1);
+
+        auto semi = item.find(';');
+        std::string_view name = trim(item.substr(0, semi));
+        int q = semi == std::string_view::npos ? 1000 : quality(item.substr(semi + 1));
+        if (iequals(name, "gzip") || iequals(name, "x-gzip")) {
+            gzip = q;
+        } else if (iequals(name, "deflate")) {
+            deflate = q;
+        } else if (name == "*") {
+            any = q;
+        }
+    }
+
+    if (gzip < 0) gzip = any;
+    if (deflate < 0) deflate = any;
+    // gzip wins ties, as some clients mishandle deflate
+    if (gzip > 0 && gzip >= deflate) return ContentCoding::Gzip;
+    if (deflate > 0) return ContentCoding::Deflate;
+    return ContentCoding::Identity;
+}
+
+std::string_view coding_name(ContentCoding coding) {
+    switch (coding) {
+    case ContentCoding::Gzip: return "gzip";
+    case ContentCoding::Deflate: return "deflate";
+    default: return "identity";
+    }
+}
+
+bool compressible_type(std::string_view content_type, const CompressionOptions& options) {
+    for (const std::string& prefix : options.content_types) {
+        if (content_type.size() >= prefix.size() &&
+            iequals(content_type.substr(0, prefix.size()), prefix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool compressible(const Res& response, ContentCoding coding, const CompressionOptions& options) {
+    if (coding == ContentCoding::Identity || response.has_file() ||
+        response.body.size() < options.min_size ||
+        response.status_code == 204 || response.status_code == 304 ||
+        response.headers.contains(Header::ContentEncoding)) {
+        return false;
+    }
+
+    // Responses without a Content-Type go out as JSON
+    const std::string* content_type = response.headers.find(Header::ContentType);
+    return compressible_type(content_type ? *content_type : "application/json", options);
+}
+
+void compress_response(Res& response, ContentCoding coding, const CompressionOptions& options) {
+    // Whatever this client gets, another one may get a different form
+    if (!options.enabled || !compressible(response, ContentCoding::Gzip, options)) {
+        return;
+    }
+    vary_on_encoding(response.headers);
+    if (coding == ContentCoding::Identity) {
+        return;
+    }
+
+    DeflaterPtr deflater = Deflater::acquire(coding, options.level);
+    std::string compressed;
+    compressed.reserve(response.body.size() / 2);
+    if (!deflater->deflate(response.body, compressed, Deflater::Flush::Finish) ||
+        compressed.size() >= response.body.size()) {
+        return;
+    }
+
+    response.body = std::move(compressed);
+    // A strong tag must differ per coding; see revalidate()
+    std::string* etag = response.headers.find(Header::ETag);
+    if (etag && etag->size() >= 2 && etag->back() == '"') {
+        etag->insert(etag->size() - 1, "-" + std::string(coding_name(coding)));
+    }
+    response.headers["Content-Encoding"] = coding_name(coding);
+}
+
+void vary_on_encoding(ResHeaders& headers) {
+    std::string* vary = headers.find(Header::Vary);
+    if (!vary || trim(*vary).empty()) {
+        headers["Vary"] = "Accept-Encoding";
+        return;
+    }
+    std::string_view fields = *vary;
+    while (!fields.empty()) {
+        auto comma = fields.find(',');
+        std::string_view field = trim(fields.substr(0, comma));
+        if (field == "*" || iequals(field, "Accept-Encoding")) return;
+        fields = comma == std::string_view::npos ? std::string_view{} : fields.substr(comma + 1);
+    }
+    vary->append(", Accept-Encoding");
+}
+
+// Deflater implementations
+struct Deflater::State {
+    z_stream stream = {};
+};
+
+namespace {
+
+// Idle deflaters of this worker, one list per coding
+struct DeflaterPool {
+    std::vector<Deflater*> idle[3];
+
+    ~DeflaterPool() {
+        for (auto& list : idle) {
+            for (Deflater* deflater : list) delete deflater;
+        }
+    }
+};
+
+thread_local DeflaterPool deflater_pool;
+
+}
+
+Deflater::Deflater(ContentCoding coding, int level)
+    : state_(std::make_unique<State>()), coding_(coding), level_(level) {
+    int window_bits = coding == ContentCoding::Gzip ? 16 + MAX_WBITS : MAX_WBITS;
+    if (deflateInit2(&state_->stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        LOG_ERROR("deflateInit2 failed");
+    }
+}
+
+Deflater::~Deflater() {
+    deflateEnd(&state_->stream);
+}
+
+DeflaterPtr Deflater::acquire(ContentCoding coding, int level) {
+    auto& idle = deflater_pool.idle[static_cast<int>(coding)];
+    Deflater* deflater;
+    if (idle.empty()) {
+        deflater = new Deflater(coding, level);
+    } else {
+        deflater = idle.back();
+        idle.pop_back();
+        if (deflater->level_ != level) {
+            deflateParams(&deflater->state_->stream, level, Z_DEFAULT_STRATEGY);
+            deflater->level_ = level;
+        }
+    }
+    return DeflaterPtr(deflater);
+}
+
+void Deflater::Release::operator()(Deflater* deflater) const {
+    deflateReset(&deflater->state_->stream);
+    deflater_pool.idle[static_cast<int>(deflater->coding_)].push_back(deflater);
+}
+
+bool Deflater::deflate(std::string_view in, std::string& out, Flush flush) {
+    z_stream& stream = state_->stream;
+    int mode = flush == Flush::Finish ? Z_FINISH : flush == Flush::Sync ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    if (in.empty() && mode == Z_NO_FLUSH) return true;
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    stream.avail_in = static_cast<uInt>(in.size());
+
+    // Grow the output until zlib has nothing more to say for this flush mode
+    while (true) {
+        size_t start = out.size();
+        size_t room = std::max<size_t>(deflateBound(&stream, stream.avail_in), 64);
+        out.resize(start + room);
+        stream.next_out = reinterpret_cast<Bytef*>(out.data() + start);
+        stream.avail_out = static_cast<uInt>(std::min<size_t>(room, UINT_MAX));
+
+        int ret = ::deflate(&stream, mode);
+        out.resize(out.size() - stream.avail_out);
+        if (ret == Z_STREAM_ERROR) {
+            LOG_ERROR("deflate failed");
+            return false;
+        }
+        if (ret == Z_STREAM_END || (stream.avail_in == 0 && stream.avail_out > 0)) {
+            return true;
+        }
+    }
+}
+
+}
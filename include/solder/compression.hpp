@@ -0,0 +1,82 @@
+#pragma once
+
+#include "http_types.hpp"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace solder {
+
+struct CompressionOptions {
+    bool enabled = false;
+    // Smaller bodies are not worth the CPU or the header bytes
+    size_t min_size = 1024;
+    int level = 6;
+    // Content-Type prefixes that compress well
+    std::vector<std::string> content_types = {
+        "text/", "application/json", "application/javascript", "application/xml", "image/svg+xml"
+    };
+};
+
+enum class ContentCoding {
+    Identity,
+    Gzip,
+    Deflate
+};
+
+// Best coding the client accepts, honoring q=0 and "*"
+ContentCoding negotiate_coding(std::string_view accept_encoding);
+
+std::string_view coding_name(ContentCoding coding);
+
+// Whether a response with this Content-Type should be compressed
+bool compressible_type(std::string_view content_type, const CompressionOptions& options);
+
+// Whether compress_response would try `coding` on this response. Only
+// the size of the result is left to decide, and that follows from the
+// body, so the same body always ends up the same way.
+bool compressible(const Res& response, ContentCoding coding, const CompressionOptions& options);
+
+// Compresses the body in place when it is allowed, big enough and gets
+// smaller, and sets Content-Encoding. Any answer compression could apply
+// to gets Vary: Accept-Encoding, the identity form included.
+void compress_response(Res& response, ContentCoding coding, const CompressionOptions& options);
+
+// Adds Accept-Encoding to Vary, keeping the fields it names already
+void vary_on_encoding(ResHeaders& headers);
+
+// A deflate stream taken from a per-worker pool. zlib's state is about
+// 256 KB, so it is reset and reused instead of set up per response.
+class Deflater {
+public:
+    enum class Flush {
+        None,
+        Sync,     // everything so far can be decoded by the client
+        Finish
+    };
+
+    // Hands the deflater back to its pool, reset for the next response
+    struct Release {
+        void operator()(Deflater* deflater) const;
+    };
+
+    static std::unique_ptr<Deflater, Release> acquire(ContentCoding coding, int level);
+
+    ~Deflater();
+
+    // Appends the compressed form of `in` to `out`
+    bool deflate(std::string_view in, std::string& out, Flush flush);
+
+private:
+    struct State;
+    std::unique_ptr<State> state_;
+    ContentCoding coding_;
+    int level_;
+
+    Deflater(ContentCoding coding, int level);
+};
+
+using DeflaterPtr = std::unique_ptr<Deflater, Deflater::Release>;
+
+}
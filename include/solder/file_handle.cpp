@@ -0,0 +1,45 @@
+#include "file_handle.hpp"
+#include <photon/common/alog.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace solder {
+
+std::shared_ptr<FileHandle> FileHandle::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOG_DEBUG("Failed to open ", path.c_str(), " errno: ", errno);
+        return nullptr;
+    }
+    return adopt(fd);
+}
+
+std::shared_ptr<FileHandle> FileHandle::adopt(int fd) {
+    std::shared_ptr<FileHandle> handle(new FileHandle(fd));
+    if (!handle->refresh()) {
+        return nullptr;
+    }
+    return handle;
+}
+
+FileHandle::~FileHandle() {
+    ::close(fd_);
+}
+
+bool FileHandle::refresh() {
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EISDIR;
+        return false;
+    }
+    size_ = st.st_size;
+    mtime_ = st.st_mtime;
+    return true;
+}
+
+}
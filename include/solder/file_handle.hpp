@@ -0,0 +1,39 @@
+#pragma once
+
+#include <ctime>
+#include <memory>
+#include <string>
+
+namespace solder {
+
+// An open file that responses can share. Keep one around for files that
+// are served often so they are not reopened per request; the descriptor
+// is closed once the last response sending it is done.
+class FileHandle {
+public:
+    // nullptr (with errno set) if the path is missing or not a regular file
+    static std::shared_ptr<FileHandle> open(const std::string& path);
+    // Takes ownership of an already open descriptor
+    static std::shared_ptr<FileHandle> adopt(int fd);
+
+    ~FileHandle();
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    int fd() const { return fd_; }
+    size_t size() const { return size_; }
+    time_t mtime() const { return mtime_; }
+
+    // Picks up a new size and mtime for files that change in place
+    bool refresh();
+
+private:
+    explicit FileHandle(int fd) : fd_(fd) {}
+
+    int fd_;
+    size_t size_ = 0;
+    time_t mtime_ = 0;
+};
+
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "http_types.hpp"
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+namespace solder {
+
+using FixedHandler = void (*)(const Req&, Res&);
+
+// A string literal usable as a template argument
+template <size_t N>
+struct FixedString {
+    char data[N];
+
+    constexpr FixedString(const char (&text)[N]) {
+        for (size_t i = 0; i < N; ++i) data[i] = text[i];
+    }
+    constexpr std::string_view view() const { return {data, N - 1}; }
+};
+
+// One exact route known at build time. Handler is a function or a
+// captureless lambda taking (const Req&, Res&) or returning Res.
+template <FixedString Method, FixedString Path, auto Handler>
+struct FixedRoute {
+    static constexpr std::string_view method = Method.view();
+    static constexpr std::string_view path = Path.view();
+
+    static void invoke(const Req& request, Res& response) {
+        if constexpr (std::is_invocable_v<decltype(Handler), const Req&, Res&>) {
+            Handler(request, response);
+        } else {
+            response = Handler(request);
+        }
+    }
+};
+
+// Exact routes laid out in a hash table at compile time. Lookup hashes
+// the method and path once and compares a slot or two; each handler is
+// inlined into its own function, so dispatch costs one direct call.
+// Install with HttpRouter::set_fixed_routes(&FixedRoutes<...>::find);
+// anything not listed falls through to the router's own routes.
+// Fixed routes bypass middleware by design, global and group alike, so
+// keep anything that needs auth or other checks out of them.
+//
+//     using Routes = FixedRoutes<
+//         FixedRoute<"GET", "/health", health>,
+//         FixedRoute<"GET", "/version", [](const Req&) { return Res::ok("1.0"); }>>;
+template <typename... Routes>
+class FixedRoutes {
+    static_assert(sizeof...(Routes) > 0, "FixedRoutes needs at least one route");
+
+public:
+    static FixedHandler find(std::string_view method, std::string_view path) {
+        size_t index = hash(method, path) & (table_size - 1);
+        while (table[index].used) {
+            const Slot& slot = table[index];
+            if (slot.path == path && slot.method == method) {
+                return slot.handler;
+            }
+            index = (index + 1) & (table_size - 1);
+        }
+        return nullptr;
+    }
+
+private:
+    struct Slot {
+        std::string_view method;
+        std::string_view path;
+        FixedHandler handler = nullptr;
+        // Testing handler itself is not a constant expression
+        bool used = false;
+    };
+
+    // At most half full, so probes stay short
+    static constexpr size_t table_size = std::bit_ceil(sizeof...(Routes) * 2 + 1);
+
+    // FNV-1a over method and path
+    static constexpr uint64_t hash(std::string_view method, std::string_view path) {
+        uint64_t h = 14695981039346656037ull;
+        for (char c : method) h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        h = (h ^ ' ') * 1099511628211ull;
+        for (char c : path) h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        return h;
+    }
+
+    static constexpr std::array<Slot, table_size> build() {
+        std::array<Slot, table_size> slots{};
+        Slot routes[] = {Slot{Routes::method, Routes::path, &Routes::invoke, true}...};
+        for (const Slot& route : routes) {
+            size_t index = hash(route.method, route.path) & (table_size - 1);
+            while (slots[index].used) {
+                if (slots[index].method == route.method && slots[index].path == route.path) {
+                    // Not a constant expression, so a duplicate fails to compile
+                    throw "Duplicate fixed route";
+                }
+                index = (index + 1) & (table_size - 1);
+            }
+            slots[index] = route;
+        }
+        return slots;
+    }
+
+    static constexpr std::array<Slot, table_size> table = build();
+};
+
+}
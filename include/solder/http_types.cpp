@@ -1,33 +1,628 @@
 #include "http_types.hpp"
-#include <sstream>
+#include "file_handle.hpp"
+#include <photon/common/checksum/crc32c.h>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
 
 namespace solder {
 
-// HttpRequest implementations
-std::unordered_map<std::string, std::string> Req::get_query_params() const {
-    std::unordered_map<std::string, std::string> params;
-    if (query.empty()) return params;
+namespace {
+
+constexpr char ascii_lower(char c) {
+    return static_cast<unsigned char>(c - 'A') < 26 ? c + ('a' - 'A') : c;
+}
+
+// Indexed by Header
+constexpr std::string_view header_names[well_known_headers] = {
+    "Host",
+    "Connection",
+    "Keep-Alive",
+    "Content-Length",
+    "Content-Type",
+    "Content-Encoding",
+    "Content-Disposition",
+    "Transfer-Encoding",
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Authorization",
+    "Cookie",
+    "Set-Cookie",
+    "User-Agent",
+    "Referer",
+    "Origin",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Expect",
+    "Upgrade",
+    "Cache-Control",
+    "X-Forwarded-For",
+    "Range",
+    "Server",
+    "Date",
+    "ETag",
+    "Location",
+    "Vary",
+    "Last-Modified",
+};
+
+// Length plus first and last letter is enough to tell the names above apart
+constexpr size_t header_hash_size = 64;
+
+constexpr size_t header_hash(std::string_view name) {
+    return (name.size() + ascii_lower(name.front()) * 36 + ascii_lower(name.back()) * 24) & (header_hash_size - 1);
+}
+
+constexpr std::array<uint8_t, header_hash_size> make_header_table() {
+    std::array<uint8_t, header_hash_size> table{};
+    for (auto& entry : table) entry = static_cast<uint8_t>(Header::Other);
+    for (size_t i = 0; i < well_known_headers; ++i) {
+        table[header_hash(header_names[i])] = static_cast<uint8_t>(i);
+    }
+    return table;
+}
+
+constexpr auto header_table = make_header_table();
+
+constexpr bool header_hash_is_perfect() {
+    for (size_t i = 0; i < well_known_headers; ++i) {
+        if (header_table[header_hash(header_names[i])] != i) return false;
+    }
+    return true;
+}
+
+static_assert(header_hash_is_perfect(), "header_hash collides, pick new multipliers");
+
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (ascii_lower(a[i]) != ascii_lower(b[i])) return false;
+    }
+    return true;
+}
+
+Header lookup_header(std::string_view name) {
+    if (name.empty()) return Header::Other;
+    auto id = static_cast<Header>(header_table[header_hash(name)]);
+    if (id != Header::Other && iequals(name, header_names[static_cast<size_t>(id)])) {
+        return id;
+    }
+    return Header::Other;
+}
+
+std::string_view header_name(Header id) {
+    return id == Header::Other ? std::string_view{} : header_names[static_cast<size_t>(id)];
+}
+
+namespace {
+
+constexpr std::string_view method_names[method_count] = {
+    "GET",
+    "HEAD",
+    "POST",
+    "PUT",
+    "DELETE",
+    "PATCH",
+    "OPTIONS",
+    "CONNECT",
+    "TRACE",
+};
+
+}
+
+Method parse_method(std::string_view name) {
+    // The first letter and the length tell the standard methods apart
+    Method id;
+    switch (name.size() > 0 ? name[0] : 0) {
+    case 'G': id = Method::Get; break;
+    case 'H': id = Method::Head; break;
+    case 'P': id = name.size() == 4 ? Method::Post : name.size() == 3 ? Method::Put : Method::Patch; break;
+    case 'D': id = Method::Delete; break;
+    case 'O': id = Method::Options; break;
+    case 'C': id = Method::Connect; break;
+    case 'T': id = Method::Trace; break;
+    default: return Method::Other;
+    }
+    return name == method_names[static_cast<size_t>(id)] ? id : Method::Other;
+}
+
+std::string_view method_name(Method id) {
+    return id == Method::Other ? std::string_view{} : method_names[static_cast<size_t>(id)];
+}
+
+// ReqHeaders implementations
+void ReqHeaders::clear() {
+    size_ = 0;
+    std::memset(slots_, 0, sizeof(slots_));
+}
+
+void ReqHeaders::add(std::string_view name, std::string_view value) {
+    Header id = lookup_header(name);
+    entries_[size_] = {name, value};
+    ids_[size_] = id;
+    ++size_;
+
+    uint8_t& slot = slots_[static_cast<size_t>(id)];
+    if (id != Header::Other && slot == 0) {
+        slot = static_cast<uint8_t>(size_);
+    }
+}
+
+const HeaderView* ReqHeaders::find(std::string_view name) const {
+    Header id = lookup_header(name);
+    if (id != Header::Other) {
+        return find(id);
+    }
+    for (size_t i = 0; i < size_; ++i) {
+        if (ids_[i] == Header::Other && iequals(entries_[i].name, name)) {
+            return &entries_[i];
+        }
+    }
+    return nullptr;
+}
+
+// ResHeaders implementations
+void ResHeaders::clear() {
+    // Inline entries keep their strings' capacity for the next response
+    size_ = 0;
+    spilled_.clear();
+    std::memset(slots_, 0, sizeof(slots_));
+}
+
+ResHeaders::ResHeaders(std::initializer_list<ResHeader> headers) {
+    clear();
+    for (const ResHeader& header : headers) {
+        add(header.name, header.value);
+    }
+}
+
+ResHeader& ResHeaders::append(std::string_view name, Header id) {
+    ResHeader* entry;
+    if (size_ < inline_capacity && spilled_.empty()) {
+        entry = &inline_[size_];
+        entry->name.assign(name);
+        entry->value.clear();
+    } else {
+        if (spilled_.empty()) {
+            spilled_.reserve(inline_capacity * 2);
+            for (size_t i = 0; i < size_; ++i) spilled_.push_back(std::move(inline_[i]));
+        }
+        entry = &spilled_.emplace_back(ResHeader{std::string(name), {}});
+    }
+    ++size_;
+
+    uint16_t& slot = slots_[static_cast<size_t>(id)];
+    if (id != Header::Other && slot == 0) {
+        slot = static_cast<uint16_t>(size_);
+    }
+    return *entry;
+}
+
+void ResHeaders::set(std::string_view name, std::string value) {
+    (*this)[name] = std::move(value);
+}
+
+void ResHeaders::add(std::string_view name, std::string value) {
+    append(name, lookup_header(name)).value = std::move(value);
+}
+
+std::string& ResHeaders::operator[](std::string_view name) {
+    Header id = lookup_header(name);
+    std::string* value = id != Header::Other ? find(id) : find(name);
+    return value ? *value : append(name, id).value;
+}
+
+std::string* ResHeaders::find(std::string_view name) {
+    Header id = lookup_header(name);
+    if (id != Header::Other) {
+        return find(id);
+    }
+    ResHeader* entries = data();
+    for (size_t i = 0; i < size_; ++i) {
+        if (iequals(entries[i].name, name)) {
+            return &entries[i].value;
+        }
+    }
+    return nullptr;
+}
+
+void ResHeaders::erase(std::string_view name) {
+    ResHeader* entries = data();
+    size_t kept = 0;
+    for (size_t i = 0; i < size_; ++i) {
+        if (iequals(entries[i].name, name)) continue;
+        if (kept != i) std::swap(entries[kept], entries[i]);
+        ++kept;
+    }
+    if (kept == size_) return;
+    if (!spilled_.empty()) spilled_.resize(kept);
+    size_ = kept;
+    reindex();
+}
+
+void ResHeaders::reindex() {
+    std::memset(slots_, 0, sizeof(slots_));
+    const ResHeader* entries = data();
+    for (size_t i = 0; i < size_; ++i) {
+        Header id = lookup_header(entries[i].name);
+        uint16_t& slot = slots_[static_cast<size_t>(id)];
+        if (id != Header::Other && slot == 0) {
+            slot = static_cast<uint16_t>(i + 1);
+        }
+    }
+}
+
+// Query string implementations
+namespace {
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = ascii_lower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Decodes one character of `raw` at `i`, advancing `i` past it
+char decode_at(std::string_view raw, size_t& i) {
+    char c = raw[i++];
+    if (c == '+') return ' ';
+    if (c == '%' && i + 2 <= raw.size()) {
+        int hi = hex_value(raw[i]);
+        int lo = hex_value(raw[i + 1]);
+        if (hi >= 0 && lo >= 0) {
+            i += 2;
+            return static_cast<char>(hi * 16 + lo);
+        }
+    }
+    return c;
+}
+
+bool needs_decoding(std::string_view raw) {
+    return raw.find_first_of("%+") != std::string_view::npos;
+}
+
+// Compares the decoded form of `raw` against `name` without materializing it
+bool decoded_equals(std::string_view raw, std::string_view name) {
+    if (!needs_decoding(raw)) return raw == name;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < raw.size()) {
+        if (j == name.size() || decode_at(raw, i) != name[j++]) return false;
+    }
+    return j == name.size();
+}
+
+}
+
+std::string_view percent_decode(std::string_view raw, char* out) {
+    if (!needs_decoding(raw)) return raw;
+    size_t len = 0;
+    for (size_t i = 0; i < raw.size();) {
+        out[len++] = decode_at(raw, i);
+    }
+    return std::string_view(out, len);
+}
+
+std::string_view percent_decode(std::string_view raw, std::string& scratch) {
+    if (!needs_decoding(raw)) return raw;
+    scratch.resize(raw.size());
+    std::string_view decoded = percent_decode(raw, scratch.data());
+    scratch.resize(decoded.size());
+    return scratch;
+}
+
+void QueryParams::iterator::advance() {
+    // Empty pairs, as in "a=1&&b=2", are skipped
+    while (!rest_.empty()) {
+        auto amp_pos = rest_.find('&');
+        std::string_view pair = rest_.substr(0, amp_pos);
+        rest_ = amp_pos == std::string_view::npos ? rest_.substr(rest_.size()) : rest_.substr(amp_pos + 1);
+        if (pair.empty()) continue;
 
-    std::istringstream iss(query);
-    std::string pair;
-    while (std::getline(iss, pair, '&')) {
         auto eq_pos = pair.find('=');
-        if (eq_pos != std::string::npos) {
-            std::string key = pair.substr(0, eq_pos);
-            std::string value = pair.substr(eq_pos + 1);
-            params[key] = value;
+        if (eq_pos != std::string_view::npos) {
+            current_ = {pair.substr(0, eq_pos), pair.substr(eq_pos + 1)};
+        } else {
+            current_ = {pair, {}};
         }
+        done_ = false;
+        return;
+    }
+    rest_ = {};
+    done_ = true;
+}
+
+std::optional<std::string_view> QueryParams::find(std::string_view key) const {
+    for (const QueryParam& param : *this) {
+        if (decoded_equals(param.key, key)) return param.value;
+    }
+    return std::nullopt;
+}
+
+// HttpRequest implementations
+std::optional<std::string_view> Req::query_param(std::string_view name, std::string& scratch) const {
+    auto raw = query_params().find(name);
+    if (!raw) return std::nullopt;
+    return percent_decode(*raw, scratch);
+}
+
+std::unordered_map<std::string, std::string> Req::get_query_params() const {
+    std::unordered_map<std::string, std::string> params;
+    std::string key;
+    std::string value;
+    for (const QueryParam& param : query_params()) {
+        params[std::string(percent_decode(param.key, key))] = std::string(percent_decode(param.value, value));
     }
     return params;
 }
 
-bool Req::has_header(const std::string& name) const {
-    return headers.find(name) != headers.end();
+bool Req::has_header(std::string_view name) const {
+    return headers.find(name) != nullptr;
+}
+
+bool Req::has_header(Header id) const {
+    return headers.find(id) != nullptr;
+}
+
+std::string_view Req::get_header(std::string_view name, std::string_view default_value) const {
+    const HeaderView* header = headers.find(name);
+    return header ? header->value : default_value;
+}
+
+std::string_view Req::get_header(Header id, std::string_view default_value) const {
+    const HeaderView* header = headers.find(id);
+    return header ? header->value : default_value;
+}
+
+OwnedReq Req::to_owned() const {
+    OwnedReq owned;
+    owned.method.assign(method);
+    owned.path.assign(path);
+    owned.query.assign(query);
+    owned.minor_version = minor_version;
+    owned.headers.reserve(headers.size());
+    for (const HeaderView& header : headers) {
+        owned.headers.emplace(header.name, header.value);
+    }
+    for (const HeaderView& param : params) {
+        owned.params.emplace(param.name, param.value);
+    }
+    owned.body.assign(body);
+    return owned;
+}
+
+namespace {
+
+struct StatusLine {
+    std::string_view line;   // "HTTP/1.1 200 OK\r\n"
+    std::string_view text;   // "OK"
+};
+
+constexpr StatusLine status_line(std::string_view line) {
+    return {line, line.substr(13, line.size() - 15)};
+}
+
+constexpr StatusLine status_lines[] = {
+    status_line("HTTP/1.1 100 Continue\r\n"),
+    status_line("HTTP/1.1 101 Switching Protocols\r\n"),
+    status_line("HTTP/1.1 200 OK\r\n"),
+    status_line("HTTP/1.1 201 Created\r\n"),
+    status_line("HTTP/1.1 202 Accepted\r\n"),
+    status_line("HTTP/1.1 204 No Content\r\n"),
+    status_line("HTTP/1.1 206 Partial Content\r\n"),
+    status_line("HTTP/1.1 301 Moved Permanently\r\n"),
+    status_line("HTTP/1.1 302 Found\r\n"),
+    status_line("HTTP/1.1 303 See Other\r\n"),
+    status_line("HTTP/1.1 304 Not Modified\r\n"),
+    status_line("HTTP/1.1 307 Temporary Redirect\r\n"),
+    status_line("HTTP/1.1 308 Permanent Redirect\r\n"),
+    status_line("HTTP/1.1 400 Bad Request\r\n"),
+    status_line("HTTP/1.1 401 Unauthorized\r\n"),
+    status_line("HTTP/1.1 403 Forbidden\r\n"),
+    status_line("HTTP/1.1 404 Not Found\r\n"),
+    status_line("HTTP/1.1 405 Method Not Allowed\r\n"),
+    status_line("HTTP/1.1 406 Not Acceptable\r\n"),
+    status_line("HTTP/1.1 408 Request Timeout\r\n"),
+    status_line("HTTP/1.1 409 Conflict\r\n"),
+    status_line("HTTP/1.1 410 Gone\r\n"),
+    status_line("HTTP/1.1 411 Length Required\r\n"),
+    status_line("HTTP/1.1 412 Precondition Failed\r\n"),
+    status_line("HTTP/1.1 413 Payload Too Large\r\n"),
+    status_line("HTTP/1.1 414 URI Too Long\r\n"),
+    status_line("HTTP/1.1 415 Unsupported Media Type\r\n"),
+    status_line("HTTP/1.1 416 Range Not Satisfiable\r\n"),
+    status_line("HTTP/1.1 417 Expectation Failed\r\n"),
+    status_line("HTTP/1.1 422 Unprocessable Entity\r\n"),
+    status_line("HTTP/1.1 426 Upgrade Required\r\n"),
+    status_line("HTTP/1.1 429 Too Many Requests\r\n"),
+    status_line("HTTP/1.1 431 Request Header Fields Too Large\r\n"),
+    status_line("HTTP/1.1 500 Internal Server Error\r\n"),
+    status_line("HTTP/1.1 501 Not Implemented\r\n"),
+    status_line("HTTP/1.1 502 Bad Gateway\r\n"),
+    status_line("HTTP/1.1 503 Service Unavailable\r\n"),
+    status_line("HTTP/1.1 504 Gateway Timeout\r\n"),
+    status_line("HTTP/1.1 505 HTTP Version Not Supported\r\n"),
+};
+
+// Indexed by status code
+constexpr std::array<StatusLine, 600> make_status_table() {
+    std::array<StatusLine, 600> table{};
+    for (const StatusLine& status : status_lines) {
+        size_t code = (status.line[9] - '0') * 100 + (status.line[10] - '0') * 10 + (status.line[11] - '0');
+        table[code] = status;
+    }
+    return table;
+}
+
+constexpr auto status_table = make_status_table();
+
+constexpr std::string_view default_content_type = "Content-Type: application/json\r\n";
+constexpr std::string_view default_connection = "Connection: keep-alive\r\n";
+constexpr std::string_view default_server = "Server: PicoHTTP/2.0\r\n";
+constexpr std::string_view content_length_name = "Content-Length: ";
+
+size_t count_digits(size_t value) {
+    size_t digits = 1;
+    while (value >= 10) {
+        value /= 10;
+        ++digits;
+    }
+    return digits;
+}
+
+char* write_uint(char* p, size_t value, size_t digits) {
+    char* end = p + digits;
+    do {
+        *--end = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (end > p) *--end = '0';
+    return p + digits;
+}
+
+char* put(char* p, std::string_view s) {
+    std::memcpy(p, s.data(), s.size());
+    return p + s.size();
+}
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n", rendered once per second per worker
+struct DateLine {
+    char text[40];
+    size_t len = 0;
+};
+
+thread_local DateLine date_line;
+
+}
+
+void update_date_header() {
+    static constexpr char days[7][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static constexpr char months[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                           "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    time_t now = time(nullptr);
+    struct tm tm;
+    gmtime_r(&now, &tm);
+
+    char* p = date_line.text;
+    p = put(p, "Date: ");
+    p = put(p, std::string_view(days[tm.tm_wday], 3));
+    p = put(p, ", ");
+    p = write_uint(p, tm.tm_mday, 2);
+    *p++ = ' ';
+    p = put(p, std::string_view(months[tm.tm_mon], 3));
+    *p++ = ' ';
+    p = write_uint(p, tm.tm_year + 1900, 4);
+    *p++ = ' ';
+    p = write_uint(p, tm.tm_hour, 2);
+    *p++ = ':';
+    p = write_uint(p, tm.tm_min, 2);
+    *p++ = ':';
+    p = write_uint(p, tm.tm_sec, 2);
+    p = put(p, " GMT\r\n");
+    date_line.len = p - date_line.text;
+}
+
+std::string_view reason_phrase(int status_code) {
+    unsigned code = static_cast<unsigned>(status_code);
+    if (code < status_table.size() && !status_table[code].line.empty()) {
+        return status_table[code].text;
+    }
+    return "Unknown";
+}
+
+std::string_view date_header() {
+    if (date_line.len == 0) {
+        update_date_header();
+    }
+    return std::string_view(date_line.text, date_line.len);
+}
+
+namespace {
+
+// What a response head needs, worked out before anything is written
+struct HeadPlan {
+    const StatusLine* status = nullptr;
+    unsigned code;
+    bool has_content_type = false;
+    bool has_connection = false;
+    bool has_server = false;
+    bool has_date = false;
+    std::string_view date;
+    bool content_length;
+    size_t length_digits;
+    size_t size;
+};
+
+HeadPlan plan_head(const Res& res, bool content_length) {
+    HeadPlan plan;
+    plan.code = static_cast<unsigned>(res.status_code);
+    // These never have a body, so nothing describes one
+    bool bodiless = plan.code == 204 || plan.code == 304;
+    plan.content_length = content_length && !bodiless;
+    plan.has_content_type = bodiless;
+    if (plan.code < status_table.size() && !status_table[plan.code].line.empty() &&
+        status_table[plan.code].text == res.status_text) {
+        plan.status = &status_table[plan.code];
+    }
+    size_t size = plan.status ? plan.status->line.size()
+                              : 9 + count_digits(plan.code) + 1 + res.status_text.size() + 2;
+
+    for (const auto& [key, value] : res.headers) {
+        size += key.size() + 2 + value.size() + 2;
+    }
+    plan.has_content_type = plan.has_content_type || res.headers.contains(Header::ContentType);
+    plan.has_connection = res.headers.contains(Header::Connection);
+    plan.has_server = res.headers.contains(Header::Server);
+    plan.has_date = res.headers.contains(Header::Date);
+
+    if (!plan.has_date) plan.date = date_header();
+    plan.length_digits = count_digits(res.content_length());
+    if (!plan.has_content_type) size += default_content_type.size();
+    if (!plan.has_connection) size += default_connection.size();
+    if (!plan.has_server) size += default_server.size();
+    size += plan.date.size();
+    if (plan.content_length) size += content_length_name.size() + plan.length_digits + 2;
+    plan.size = size + 2;
+    return plan;
+}
+
+char* write_head(const Res& res, const HeadPlan& plan, char* p) {
+    if (plan.status) {
+        p = put(p, plan.status->line);
+    } else {
+        p = put(p, "HTTP/1.1 ");
+        p = write_uint(p, plan.code, count_digits(plan.code));
+        *p++ = ' ';
+        p = put(p, res.status_text);
+        p = put(p, "\r\n");
+    }
+
+    for (const auto& [key, value] : res.headers) {
+        p = put(p, key);
+        p = put(p, ": ");
+        p = put(p, value);
+        p = put(p, "\r\n");
+    }
+
+    // Default headers unless the handler set them
+    if (!plan.has_content_type) p = put(p, default_content_type);
+    if (!plan.has_connection) p = put(p, default_connection);
+    if (!plan.has_server) p = put(p, default_server);
+    if (!plan.has_date) p = put(p, plan.date);
+
+    if (plan.content_length) {
+        p = put(p, content_length_name);
+        p = write_uint(p, res.content_length(), plan.length_digits);
+        p = put(p, "\r\n");
+    }
+    return put(p, "\r\n");
 }
 
-std::string Req::get_header(const std::string& name, const std::string& default_value) const {
-    auto it = headers.find(name);
-    return it != headers.end() ? it->second : default_value;
 }
 
 // HttpResponse implementations
@@ -43,6 +638,10 @@ Res Res::no_content() {
     return {204, "No Content", {}, ""};
 }
 
+Res Res::not_modified() {
+    return {304, "Not Modified", {}, ""};
+}
+
 Res Res::bad_request(const std::string& message) {
     return {400, "Bad Request", {{"Content-Type", "application/json"}},
             R"({"error": "Bad Request", "message": ")" + std::move(message) + R"("})"};
@@ -53,70 +652,218 @@ Res Res::not_found(const std::string& message) {
             R"({"error": "Not Found", "message": ")" + std::move(message) + R"("})"};
 }
 
-Res Res::internal_error(const std::string& message) {
-    return {500, "Internal Server Error", {{"Content-Type", "application/json"}},
-            R"({"error": "Internal Server Error", "message": ")" + std::move(message) + R"("})"};
+Res Res::payload_too_large(const std::string& message) {
+    return {413, "Payload Too Large", {{"Content-Type", "application/json"}},
+            R"({"error": "Payload Too Large", "message": ")" + std::move(message) + R"("})"};
 }
 
-std::string Res::to_string() const {
-    std::string response = "HTTP/1.1 " + std::to_string(status_code) + " " + status_text + "\r\n";
+Res Res::header_fields_too_large(const std::string& message) {
+    return {431, "Request Header Fields Too Large", {{"Content-Type", "application/json"}},
+            R"({"error": "Request Header Fields Too Large", "message": ")" + std::move(message) + R"("})"};
+}
 
-    // Tambah headers yang sudah ada
-    bool has_content_type = false;
-    bool has_connection = false;
-    bool has_server = false;
+Res Res::method_not_allowed(std::string allow) {
+    return {405, "Method Not Allowed", {{"Allow", std::move(allow)}, {"Content-Type", "application/json"}},
+            R"({"error": "Method Not Allowed"})"};
+}
 
-    for (const auto& [key, value] : headers) {
-        response += key + ": " + value + "\r\n";
+Res Res::unsupported_media_type(const std::string& message) {
+    return {415, "Unsupported Media Type", {{"Content-Type", "application/json"}},
+            R"({"error": "Unsupported Media Type", "message": ")" + std::move(message) + R"("})"};
+}
+
+Res Res::internal_error(const std::string& message) {
+    return {500, "Internal Server Error", {{"Content-Type", "application/json"}},
+            R"({"error": "Internal Server Error", "message": ")" + std::move(message) + R"("})"};
+}
 
-        // Tracking keys
-        if (key == "Content-Type") has_content_type = true;
-        else if (key == "Connection") has_connection = true;
-        else if (key == "Server") has_server = true;
+Res Res::file(const std::string& path, size_t offset, size_t length) {
+    auto handle = FileHandle::open(path);
+    if (!handle) {
+        return not_found("The requested file was not found");
     }
+    return file(std::move(handle), offset, length);
+}
 
-    // Tambah default headers jika belum ada
-    if (!has_content_type) response += "Content-Type: application/json\r\n";
-    if (!has_connection)    response += "Connection: keep-alive\r\n";
-    if (!has_server)        response += "Server: PicoHTTP/2.0\r\n";
+Res Res::file(std::shared_ptr<const FileHandle> handle, size_t offset, size_t length) {
+    if (!handle) {
+        return not_found("The requested file was not found");
+    }
+    Res res{200, "OK", {{"Content-Type", "application/octet-stream"}}, ""};
+    offset = std::min(offset, handle->size());
+    size_t available = handle->size() - offset;
+    res.file_body = FileBody{std::move(handle), offset, std::min(length, available)};
+    return res;
+}
 
-    // Content-Length
-    response += "Content-Length: " + std::to_string(body.length()) + "\r\n";
+void Res::clear() {
+    status_code = 200;
+    status_text.assign("OK");
+    headers.clear();
+    body.clear();
+    file_body = {};
+}
 
-    response += "\r\n" + body;
+std::string Res::to_string() const {
+    std::string response;
+    append_to(response);
     return response;
 }
 
 void Res::append_to(std::string& response) const {
+    // Size the whole response first, then write it in one pass
+    HeadPlan plan = plan_head(*this, true);
+    size_t start = response.size();
+    response.resize(start + plan.size + content_length());
+    char* p = write_head(*this, plan, response.data() + start);
+    if (!has_file()) {
+        put(p, body);
+        return;
+    }
 
-    response = "HTTP/1.1 " + std::to_string(status_code) + " " + status_text + "\r\n";
+    // Only for callers that want the bytes; connections use sendfile
+    size_t done = 0;
+    while (done < file_body.length) {
+        ssize_t got = pread(file_body.handle->fd(), p + done, file_body.length - done, file_body.offset + done);
+        if (got <= 0) break;
+        done += got;
+    }
+    response.resize(response.size() - (file_body.length - done));
+}
 
-    // Tambah headers yang sudah ada
-    bool has_content_type = false;
-    bool has_connection = false;
-    bool has_server = false;
+void Res::append_head_to(std::string& response, bool content_length) const {
+    HeadPlan plan = plan_head(*this, content_length);
+    size_t start = response.size();
+    response.resize(start + plan.size);
+    write_head(*this, plan, response.data() + start);
+}
 
-    for (const auto& [key, value] : headers) {
-        response += key + ": " + value + "\r\n";
+namespace {
 
-        // Tracking keys
-        if (key == "Content-Type") has_content_type = true;
-        else if (key == "Connection") has_connection = true;
-        else if (key == "Server") has_server = true;
+std::string_view find_etag(const Res& response) {
+    const std::string* etag = response.headers.find(Header::ETag);
+    return etag ? std::string_view(*etag) : std::string_view{};
+}
+
+bool wants_etag(const Res& response) {
+    return response.status_code == 200 && !response.has_file() && !response.body.empty();
+}
+
+// The 304 for `response`, with the headers a cache would refresh
+Res not_modified_from(const Res& response) {
+    Res result = Res::not_modified();
+    for (const auto& [key, value] : response.headers) {
+        Header id = lookup_header(key);
+        if (id == Header::ETag || id == Header::Vary || id == Header::CacheControl ||
+            id == Header::LastModified || iequals(key, "Expires")) {
+            result.headers.add(key, value);
+        }
     }
+    return result;
+}
+
+}
 
-    // Tambah default headers jika belum ada
-    if (!has_content_type) response += "Content-Type: application/json\r\n";
-    if (!has_connection)    response += "Connection: keep-alive\r\n";
-    if (!has_server)        response += "Server: PicoHTTP/2.0\r\n";
+std::string make_etag(std::string_view body) {
+    std::string etag;
+    assign_etag(etag, body);
+    return etag;
+}
 
-    // Content-Length
-    response += "Content-Length: " + std::to_string(body.length()) + "\r\n";
+void assign_etag(std::string& etag, std::string_view body) {
+    static constexpr char hex[] = "0123456789abcdef";
+    uint32_t crc = crc32c(body.data(), body.size());
 
-    response += "\r\n" + body;
+    // "<crc>-<length>", both in hex
+    char tag[2 + 8 + 1 + 16];
+    char* p = tag;
+    *p++ = '"';
+    for (int shift = 28; shift >= 0; shift -= 4) *p++ = hex[(crc >> shift) & 0xf];
+    *p++ = '-';
+    size_t length = body.size();
+    int digits = 1;
+    while (digits < 16 && (length >> (digits * 4)) != 0) ++digits;
+    for (int i = digits - 1; i >= 0; --i) *p++ = hex[(length >> (i * 4)) & 0xf];
+    *p++ = '"';
+    etag.assign(tag, p - tag);
+}
 
+bool etag_matches(std::string_view if_none_match, std::string_view etag) {
+    if (etag.size() > 2 && etag.substr(0, 2) == "W/") etag.remove_prefix(2);
+    while (!if_none_match.empty()) {
+        auto comma = if_none_match.find(',');
+        std::string_view item = if_none_match.substr(0, comma);
+        if_none_match = comma == std::string_view::npos ? std::string_view{} : if_none_match.substr(comma + 1);
 
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if (item.size() > 2 && item.substr(0, 2) == "W/") item.remove_prefix(2);
+        if (item == "*" || item == etag) return true;
+    }
+    return false;
 }
 
+bool revalidate(const Req& request, Res& response, std::string_view variant) {
+    if (!wants_etag(response) || (request.method_id != Method::Get && request.method_id != Method::Head)) {
+        return false;
+    }
+
+    std::string_view etag = find_etag(response);
+    if (etag.empty()) {
+        // Into the header's existing string, so a reused response keeps it
+        std::string& value = response.headers[header_name(Header::ETag)];
+        assign_etag(value, response.body);
+        etag = value;
+    }
+
+    std::string_view if_none_match = request.get_header(Header::IfNoneMatch);
+    if (if_none_match.empty()) return false;
+    if (etag_matches(if_none_match, etag)) {
+        response = not_modified_from(response);
+        return true;
+    }
+
+    // The client may hold the compressed variant, tagged "<etag>-<coding>"
+    if (!variant.empty() && etag.size() >= 2 && etag.back() == '"') {
+        std::string tagged(etag.substr(0, etag.size() - 1));
+        tagged.append("-").append(variant).append("\"");
+        if (etag_matches(if_none_match, tagged)) {
+            response = not_modified_from(response);
+            response.headers[header_name(Header::ETag)] = std::move(tagged);
+            return true;
+        }
+    }
+    return false;
+}
+
+StaticResponse::StaticResponse(const Res& original, bool tag) {
+    // Hashed once here rather than on every request
+    std::optional<Res> tagged;
+    if (tag && wants_etag(original) && find_etag(original).empty()) {
+        tagged = original;
+        tagged->headers["ETag"] = make_etag(original.body);
+        untagged = std::make_unique<const StaticResponse>(original, false);
+    }
+    const Res& response = tagged ? *tagged : original;
+    etag = find_etag(response);
+    if (!etag.empty() && response.status_code == 200) {
+        not_modified = std::make_unique<const StaticResponse>(not_modified_from(response));
+    }
+
+    std::string bytes;
+    response.append_to(bytes);
+    body_size = bytes.size() - (bytes.find("\r\n\r\n") + 4);
+
+    // The Date line rendered just now is cut out and sent fresh each time
+    size_t head_end = bytes.find("\r\n\r\n");
+    size_t date = bytes.find(date_header());
+    patch_date = date != std::string::npos && date < head_end;
+    if (!patch_date) {
+        head = std::move(bytes);
+        return;
+    }
+    head = bytes.substr(0, date);
+    tail = bytes.substr(date + date_header().size());
+}
 
 }
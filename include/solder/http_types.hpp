@@ -1,44 +1,409 @@
 #pragma once
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+
+class iovector;
 
 namespace solder {
 
-struct Req {
+class BodyReader;
+class FileHandle;
+
+// ASCII case-insensitive comparison, as header names and tokens need
+bool iequals(std::string_view a, std::string_view b);
+
+// Headers that get a fixed slot and are found without comparing names
+enum class Header : uint8_t {
+    Host,
+    Connection,
+    KeepAlive,
+    ContentLength,
+    ContentType,
+    ContentEncoding,
+    ContentDisposition,
+    TransferEncoding,
+    Accept,
+    AcceptEncoding,
+    AcceptLanguage,
+    Authorization,
+    Cookie,
+    SetCookie,
+    UserAgent,
+    Referer,
+    Origin,
+    IfNoneMatch,
+    IfModifiedSince,
+    Expect,
+    Upgrade,
+    CacheControl,
+    XForwardedFor,
+    Range,
+    Server,
+    Date,
+    ETag,
+    Location,
+    Vary,
+    LastModified,
+    Other   // not a well-known header; also the number of slots
+};
+
+constexpr size_t well_known_headers = static_cast<size_t>(Header::Other);
+
+// Request methods, parsed once per request
+enum class Method : uint8_t {
+    Get,
+    Head,
+    Post,
+    Put,
+    Delete,
+    Patch,
+    Options,
+    Connect,
+    Trace,
+    Other   // an extension method; also the number of standard ones
+};
+
+constexpr size_t method_count = static_cast<size_t>(Method::Other);
+
+// Methods are case-sensitive, so only exact spellings match
+Method parse_method(std::string_view name);
+std::string_view method_name(Method id);
+
+// Perfect hash from a header name, in any case, to its Header
+Header lookup_header(std::string_view name);
+std::string_view header_name(Header id);
+
+struct HeaderView {
+    std::string_view name;
+    std::string_view value;
+};
+
+// Request headers in arrival order, plus one slot per well-known header
+// pointing at its first occurrence
+class ReqHeaders {
+public:
+    static constexpr size_t capacity = 64;
+
+    ReqHeaders() { clear(); }
+
+    void clear();
+    // Caller keeps size() below capacity
+    void add(std::string_view name, std::string_view value);
+
+    const HeaderView* find(Header id) const {
+        uint8_t slot = slots_[static_cast<size_t>(id)];
+        return slot ? &entries_[slot - 1] : nullptr;
+    }
+    const HeaderView* find(std::string_view name) const;
+
+    size_t size() const { return size_; }
+    Header id(size_t i) const { return ids_[i]; }
+    const HeaderView& operator[](size_t i) const { return entries_[i]; }
+    const HeaderView* begin() const { return entries_; }
+    const HeaderView* end() const { return entries_ + size_; }
+
+private:
+    HeaderView entries_[capacity];
+    Header ids_[capacity];
+    uint8_t slots_[well_known_headers + 1];   // index + 1, 0 when absent
+    size_t size_ = 0;
+};
+
+// Values of a route's ":name" and "*name" segments, pointing into the
+// request path; the names point into the router
+class PathParams {
+public:
+    static constexpr size_t capacity = 16;
+
+    void clear() { size_ = 0; }
+    // Past capacity the parameter is dropped
+    void add(std::string_view name, std::string_view value) {
+        if (size_ < capacity) entries_[size_++] = {name, value};
+    }
+    void truncate(size_t size) { size_ = size; }
+
+    const HeaderView* find(std::string_view name) const {
+        for (size_t i = 0; i < size_; ++i) {
+            if (entries_[i].name == name) return &entries_[i];
+        }
+        return nullptr;
+    }
+
+    size_t size() const { return size_; }
+    const HeaderView& operator[](size_t i) const { return entries_[i]; }
+    const HeaderView* begin() const { return entries_; }
+    const HeaderView* end() const { return entries_ + size_; }
+
+private:
+    HeaderView entries_[capacity];
+    size_t size_ = 0;
+};
+
+// Decodes %XX escapes and '+' into `out`, which needs room for raw.size()
+// bytes. Returns `raw` itself, without touching `out`, if nothing is encoded.
+std::string_view percent_decode(std::string_view raw, char* out);
+std::string_view percent_decode(std::string_view raw, std::string& scratch);
+
+// One key=value pair, both still percent-encoded
+struct QueryParam {
+    std::string_view key;
+    std::string_view value;
+};
+
+// Walks the pairs of a query string in place, without allocating
+class QueryParams {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = QueryParam;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const QueryParam*;
+        using reference = const QueryParam&;
+
+        iterator() = default;
+        explicit iterator(std::string_view rest) : rest_(rest) { advance(); }
+
+        reference operator*() const { return current_; }
+        pointer operator->() const { return &current_; }
+        iterator& operator++() { advance(); return *this; }
+        iterator operator++(int) { iterator tmp = *this; advance(); return tmp; }
+
+        bool operator==(const iterator& other) const { return done_ == other.done_ && rest_.data() == other.rest_.data(); }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        std::string_view rest_;
+        QueryParam current_;
+        bool done_ = true;
+
+        void advance();
+    };
+
+    explicit QueryParams(std::string_view query) : query_(query) {}
+
+    iterator begin() const { return iterator(query_); }
+    iterator end() const { return iterator(); }
+
+    // Raw value of the first pair whose decoded key equals `key`
+    std::optional<std::string_view> find(std::string_view key) const;
+
+private:
+    std::string_view query_;
+};
+
+// Owned copy of a request, safe to keep after the handler returns
+struct OwnedReq {
     std::string method;
     std::string path;
     std::string query;
     int minor_version = 1;
     std::unordered_map<std::string, std::string> headers;
+    std::unordered_map<std::string, std::string> params;
     std::string body;
+};
+
+// Every field points into the connection's parse buffer and is only valid
+// while the handler runs. Call to_owned() to keep the request any longer.
+struct Req {
+    std::string_view method;
+    Method method_id = Method::Other;
+    std::string_view path;
+    std::string_view query;
+    int minor_version = 1;
+    ReqHeaders headers;
+    std::string_view body;
+
+    // Path parameters of the matched route
+    PathParams params;
+
+    // Set instead of `body` for routes registered with stream_body
+    BodyReader* body_reader = nullptr;
+    // The body as pooled blocks, for routes registered with iovector_body
+    const iovector* body_iov = nullptr;
+
+    // Value of the route's ":name" or "*name" segment, still percent-encoded
+    std::string_view param(std::string_view name, std::string_view default_value = {}) const {
+        const HeaderView* found = params.find(name);
+        return found ? found->value : default_value;
+    }
+
+    // Query parameters, iterated lazily; values are still percent-encoded
+    QueryParams query_params() const { return QueryParams(query); }
+
+    // Decoded value of the first `name` parameter. It points into the query
+    // when nothing needed decoding and into `scratch` otherwise.
+    std::optional<std::string_view> query_param(std::string_view name, std::string& scratch) const;
 
-    // Parse query parameters
+    // Decoded copy of every parameter, for convenience off the hot path
     std::unordered_map<std::string, std::string> get_query_params() const;
 
-    // Helper methods
-    bool has_header(const std::string& name) const;
-    std::string get_header(const std::string& name, const std::string& default_value = "") const;
+    // Helper methods; names are matched case-insensitively
+    bool has_header(std::string_view name) const;
+    bool has_header(Header id) const;
+    std::string_view get_header(std::string_view name, std::string_view default_value = {}) const;
+    std::string_view get_header(Header id, std::string_view default_value = {}) const;
+
+    // Copy everything out of the parse buffer
+    OwnedReq to_owned() const;
+};
+
+using ReqView = Req;
+
+// This worker's "Date: ...\r\n" header line. Rendered on first use and
+// then by update_date_header(), which the server runs once a second.
+std::string_view date_header();
+void update_date_header();
+
+// The standard reason phrase of a status code, or "Unknown"
+std::string_view reason_phrase(int status_code);
+
+// Strong validator of a body: its CRC32C and length, quoted
+std::string make_etag(std::string_view body);
+// Same, written over `etag` without giving up its capacity
+void assign_etag(std::string& etag, std::string_view body);
+
+// Whether an If-None-Match value lists `etag` or is "*". Uses the weak
+// comparison RFC 9110 asks for, so W/ prefixes do not matter.
+bool etag_matches(std::string_view if_none_match, std::string_view etag);
+
+struct Res;
+
+// Gives a 200 answer to a GET or HEAD an ETag if it has none, and turns it
+// into a bodiless 304 when If-None-Match already holds that tag. `variant`
+// names the content coding the body goes out with, which compression adds
+// to the tag. Returns true for a 304.
+bool revalidate(const Req& request, Res& response, std::string_view variant = {});
+
+// A byte range of an open file, sent with sendfile instead of `body`
+struct FileBody {
+    std::shared_ptr<const FileHandle> handle;
+    size_t offset = 0;
+    size_t length = 0;
+};
+
+struct ResHeader {
+    std::string name;
+    std::string value;
+};
+
+// Response headers in the order they were set, plus one slot per
+// well-known header pointing at its first occurrence. The first few live
+// inline, so a typical response never allocates for its header list.
+class ResHeaders {
+public:
+    static constexpr size_t inline_capacity = 6;
+
+    ResHeaders() { clear(); }
+    ResHeaders(std::initializer_list<ResHeader> headers);
+
+    // Replaces the value of the first `name`, or appends it
+    void set(std::string_view name, std::string value);
+    // Appends even if `name` is present, as Set-Cookie needs
+    void add(std::string_view name, std::string value);
+    // Value of the first `name`, appended empty when missing
+    std::string& operator[](std::string_view name);
+
+    std::string* find(Header id) {
+        uint16_t slot = slots_[static_cast<size_t>(id)];
+        return slot ? &data()[slot - 1].value : nullptr;
+    }
+    const std::string* find(Header id) const { return const_cast<ResHeaders*>(this)->find(id); }
+    std::string* find(std::string_view name);
+    const std::string* find(std::string_view name) const { return const_cast<ResHeaders*>(this)->find(name); }
+
+    bool contains(Header id) const { return slots_[static_cast<size_t>(id)] != 0; }
+    bool contains(std::string_view name) const { return find(name) != nullptr; }
+    size_t count(std::string_view name) const { return contains(name) ? 1 : 0; }
+
+    // Removes every header called `name`
+    void erase(std::string_view name);
+    void clear();
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const ResHeader* begin() const { return data(); }
+    const ResHeader* end() const { return data() + size_; }
+
+private:
+    ResHeader inline_[inline_capacity];
+    // Takes over all entries once inline_ is full
+    std::vector<ResHeader> spilled_;
+    size_t size_ = 0;
+    uint16_t slots_[well_known_headers + 1];   // index + 1, 0 when absent
+
+    ResHeader* data() { return spilled_.empty() ? inline_ : spilled_.data(); }
+    const ResHeader* data() const { return spilled_.empty() ? inline_ : spilled_.data(); }
+    ResHeader& append(std::string_view name, Header id);
+    void reindex();
 };
 
 struct Res {
     int status_code = 200;
     std::string status_text = "OK";
-    std::unordered_map<std::string, std::string> headers;
+    ResHeaders headers;
     std::string body;
+    FileBody file_body = {};
 
     // Convenience methods for common responses
     static Res ok(const std::string& body = "");
     static Res created(const std::string& body = "");
     static Res no_content();
+    static Res not_modified();
     static Res bad_request(const std::string& message = "Bad Request");
     static Res not_found(const std::string& message = "Not Found");
+    // `allow` lists the methods the resource does take, as in "GET, HEAD"
+    static Res method_not_allowed(std::string allow);
+    static Res payload_too_large(const std::string& message = "Payload Too Large");
+    static Res header_fields_too_large(const std::string& message = "Request Header Fields Too Large");
+    static Res unsupported_media_type(const std::string& message = "Unsupported Media Type");
     static Res internal_error(const std::string& message = "Internal Server Error");
 
+    // Serves [offset, offset + length) of a file; 404 if it cannot be opened.
+    // Pass a handle that is kept around to avoid reopening hot files.
+    static Res file(const std::string& path, size_t offset = 0, size_t length = SIZE_MAX);
+    static Res file(std::shared_ptr<const FileHandle> handle, size_t offset = 0, size_t length = SIZE_MAX);
+
+    // Back to an empty 200 that keeps the capacity of its strings, for
+    // reuse by the next request on the connection
+    void clear();
+
+    bool has_file() const { return file_body.handle != nullptr; }
+    size_t content_length() const { return has_file() ? file_body.length : body.size(); }
+
     std::string to_string() const;
 
 
 void append_to(std::string& out) const;
+    // Everything up to and including the blank line, without the body.
+    // Leave out Content-Length for bodies framed otherwise (chunked, or
+    // ended by closing the connection).
+    void append_head_to(std::string& out, bool content_length = true) const;
+
+};
+
+// A response rendered to wire bytes once. The bytes are split around the
+// Date line so the current date can be sent in between. A 200 with a body
+// gets its ETag here, along with the 304 that answers it.
+struct StaticResponse {
+    std::string head;   // through the line before Date
+    std::string tail;   // after Date, through the body
+    bool patch_date;    // false if the response carries its own Date
+    size_t body_size;   // at the end of the last piece, left out for HEAD
+    std::string etag;
+    std::unique_ptr<const StaticResponse> not_modified;
+    // Rendered without the ETag tagging added, for servers with ETags off
+    std::unique_ptr<const StaticResponse> untagged;
 
+    // With `tag`, a 200 without an ETag is given one
+    explicit StaticResponse(const Res& response, bool tag = true);
 };
 
 
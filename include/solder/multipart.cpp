@@ -0,0 +1,290 @@
+#include "multipart.hpp"
+#include "body_reader.hpp"
+#include "picohttpparser.h"
+#include <photon/common/alog.h>
+#include <photon/fs/filesystem.h>
+#include <photon/fs/localfs.h>
+#include <fcntl.h>
+#include <cstring>
+#include <memory>
+
+namespace solder {
+
+namespace {
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// Value of `key` among the ;-separated parameters of a header value
+std::string param(std::string_view value, std::string_view key) {
+    while (!value.empty()) {
+        auto semi = value.find(';');
+        std::string_view item = trim(value.substr(0, semi));
+        value = semi == std::string_view::npos ? std::string_view{} : value.substr(semi + 1);
+
+        auto eq = item.find('=');
+        if (eq == std::string_view::npos || !iequals(trim(item.substr(0, eq)), key)) continue;
+
+        std::string_view raw = trim(item.substr(eq + 1));
+        if (raw.size() < 2 || raw.front() != '"' || raw.back() != '"') {
+            return std::string(raw);
+        }
+        std::string unquoted;
+        raw = raw.substr(1, raw.size() - 2);
+        for (size_t i = 0; i < raw.size(); ++i) {
+            if (raw[i] == '\\' && i + 1 < raw.size()) ++i;
+            unquoted += raw[i];
+        }
+        return unquoted;
+    }
+    return {};
+}
+
+}
+
+// MemorySink implementations
+bool MemorySink::write(const char* data, size_t len) {
+    if (data_.size() + len > max_size_) {
+        LOG_DEBUG("Multipart field over the in-memory limit of ", max_size_, " bytes");
+        return false;
+    }
+    data_.append(data, len);
+    return true;
+}
+
+// FileSink implementations
+FileSink::FileSink(const std::string& path)
+    : file_(photon::fs::open_localfile_adaptor(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) {
+    if (!file_) {
+        LOG_ERROR("Failed to open upload file ", path.c_str(), " errno: ", errno);
+    }
+}
+
+FileSink::~FileSink() {
+    delete file_;
+}
+
+bool FileSink::write(const char* data, size_t len) {
+    if (!file_) return false;
+    ssize_t written = file_->write(data, len);
+    if (written != static_cast<ssize_t>(len)) {
+        LOG_ERROR("Failed to write upload file, written: ", written, "/", len);
+        return false;
+    }
+    size_ += len;
+    return true;
+}
+
+bool FileSink::finish() {
+    return file_ && file_->close() == 0;
+}
+
+// MultipartParser implementations
+MultipartParser::MultipartParser(std::string_view boundary, SinkFactory sinks)
+    : sinks_(std::move(sinks)) {
+    delimiter_.reserve(boundary.size() + 4);
+    delimiter_ += "\r\n--";
+    delimiter_ += boundary;
+
+    failure_.assign(delimiter_.size(), 0);
+    for (size_t i = 1, k = 0; i < delimiter_.size(); ++i) {
+        while (k > 0 && delimiter_[i] != delimiter_[k]) k = failure_[k - 1];
+        if (delimiter_[i] == delimiter_[k]) ++k;
+        failure_[i] = k;
+    }
+
+    // The first boundary may open the body without a CRLF before it
+    match_ = 2;
+    carry_ = 2;
+}
+
+std::optional<std::string_view> MultipartParser::boundary(std::string_view content_type) {
+    auto semi = content_type.find(';');
+    if (!iequals(trim(content_type.substr(0, semi)), "multipart/form-data") || semi == std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    // Boundaries may not contain quotes or escapes, so the value can be cut
+    // straight out of the header without copying
+    std::string_view rest = content_type.substr(semi + 1);
+    while (!rest.empty()) {
+        semi = rest.find(';');
+        std::string_view item = trim(rest.substr(0, semi));
+        rest = semi == std::string_view::npos ? std::string_view{} : rest.substr(semi + 1);
+
+        auto eq = item.find('=');
+        if (eq == std::string_view::npos || !iequals(trim(item.substr(0, eq)), "boundary")) continue;
+
+        std::string_view value = trim(item.substr(eq + 1));
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+            value = value.substr(1, value.size() - 2);
+        }
+        if (value.empty() || value.size() > 70) return std::nullopt;
+        return value;
+    }
+    return std::nullopt;
+}
+
+bool MultipartParser::emit(const char* data, size_t len) {
+    if (!sink_ || len == 0) return true;
+    return sink_->write(data, len);
+}
+
+size_t MultipartParser::scan(const char* data, size_t len, bool& found) {
+    // Bytes are only emitted once they can no longer be the start of a
+    // delimiter. The held back ones always equal delimiter_[0, match_), so
+    // those that came with earlier feeds are re-emitted from delimiter_.
+    found = false;
+    size_t i = 0;
+    while (i < len) {
+        if (match_ == 0) {
+            const void* cr = std::memchr(data + i, '\r', len - i);
+            if (!cr) {
+                i = len;
+                break;
+            }
+            i = static_cast<const char*>(cr) - data;
+        }
+
+        char c = data[i++];
+        size_t m = match_;
+        while (m > 0 && delimiter_[m] != c) m = failure_[m - 1];
+        if (delimiter_[m] == c) ++m;
+        match_ = m;
+
+        size_t still_carried = m > i ? m - i : 0;
+        if (carry_ > still_carried) {
+            if (!emit(delimiter_.data(), carry_ - still_carried)) return 0;
+            carry_ = still_carried;
+        }
+
+        if (m == delimiter_.size()) {
+            if (!emit(data, i - (m - carry_))) return 0;
+            match_ = 0;
+            carry_ = 0;
+            found = true;
+            return i;
+        }
+    }
+
+    if (!emit(data, len - (match_ - carry_))) return 0;
+    carry_ = match_;
+    return len;
+}
+
+bool MultipartParser::begin_part(const phr_header* headers, size_t num_headers) {
+    PartInfo info;
+    for (size_t i = 0; i < num_headers; ++i) {
+        std::string_view name(headers[i].name, headers[i].name_len);
+        std::string_view value(headers[i].value, headers[i].value_len);
+        Header id = lookup_header(name);
+        if (id == Header::ContentDisposition) {
+            info.name = param(value, "name");
+            info.filename = param(value, "filename");
+        } else if (id == Header::ContentType) {
+            info.content_type = value;
+        }
+    }
+    sink_ = sinks_ ? sinks_(info) : nullptr;
+    return true;
+}
+
+bool MultipartParser::feed(const char* data, size_t len) {
+    if (failed_) return false;
+
+    size_t i = 0;
+    while (i < len && state_ != State::Done) {
+        switch (state_) {
+        case State::Preamble:
+        case State::Body: {
+            bool found;
+            size_t used = scan(data + i, len - i, found);
+            if (used == 0 && len - i != 0) {
+                failed_ = true;
+                return false;
+            }
+            i += used;
+            if (found) {
+                if (sink_ && !sink_->finish()) {
+                    failed_ = true;
+                    return false;
+                }
+                sink_ = nullptr;
+                state_ = State::AfterBoundary;
+            }
+            break;
+        }
+        case State::AfterBoundary: {
+            char c = data[i++];
+            if (c == '-') {
+                state_ = State::AfterBoundaryDash;
+            } else if (c == '\r') {
+                state_ = State::AfterBoundaryCR;
+            } else if (c != ' ' && c != '\t') {
+                failed_ = true;
+            }
+            break;
+        }
+        case State::AfterBoundaryDash:
+            if (data[i++] == '-') {
+                state_ = State::Done;
+            } else {
+                failed_ = true;
+            }
+            break;
+        case State::AfterBoundaryCR:
+            if (data[i++] == '\n') {
+                head_.clear();
+                state_ = State::Headers;
+            } else {
+                failed_ = true;
+            }
+            break;
+        case State::Headers: {
+            size_t before = head_.size();
+            size_t take = std::min(len - i, max_part_head - before);
+            head_.append(data + i, take);
+
+            struct phr_header headers[16];
+            size_t num_headers = sizeof(headers) / sizeof(headers[0]);
+            int ret = phr_parse_headers(head_.data(), head_.size(), headers, &num_headers, 0);
+            if (ret == -1 || (ret == -2 && head_.size() == max_part_head)) {
+                LOG_DEBUG("Malformed or oversized multipart part headers");
+                failed_ = true;
+                break;
+            }
+            if (ret == -2) {
+                i += take;
+                break;
+            }
+            // Only part of this feed belonged to the headers
+            i += ret - before;
+            begin_part(headers, num_headers);
+            state_ = State::Body;
+            break;
+        }
+        case State::Done:
+            break;
+        }
+        if (failed_) return false;
+    }
+    return true;
+}
+
+bool MultipartParser::parse(BodyReader& reader) {
+    constexpr size_t buffer_size = 64 * 1024;
+    std::unique_ptr<char[]> buffer(new char[buffer_size]);
+
+    while (true) {
+        ssize_t got = reader.read(buffer.get(), buffer_size);
+        if (got < 0) return false;
+        if (got == 0) break;
+        if (!feed(buffer.get(), got)) return false;
+    }
+    return done();
+}
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "http_types.hpp"
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct phr_header;
+
+namespace photon {
+namespace fs {
+class IFile;
+}
+}
+
+namespace solder {
+
+struct PartInfo {
+    std::string name;
+    std::string filename;   // empty for plain form fields
+    std::string content_type;
+};
+
+// Receives the bytes of one part while they are parsed
+class PartSink {
+public:
+    virtual ~PartSink() = default;
+
+    virtual bool write(const char* data, size_t len) = 0;
+    // Called once the whole part went through write()
+    virtual bool finish() { return true; }
+};
+
+// Keeps the part in memory, for small form fields
+class MemorySink : public PartSink {
+public:
+    explicit MemorySink(size_t max_size = 64 * 1024) : max_size_(max_size) {}
+
+    bool write(const char* data, size_t len) override;
+
+    const std::string& data() const { return data_; }
+
+private:
+    std::string data_;
+    size_t max_size_;
+};
+
+// Writes the part to a local file through photon's localfs as it arrives
+class FileSink : public PartSink {
+public:
+    explicit FileSink(const std::string& path);
+    ~FileSink() override;
+
+    bool ok() const { return file_ != nullptr; }
+    size_t size() const { return size_; }
+
+    bool write(const char* data, size_t len) override;
+    bool finish() override;
+
+private:
+    photon::fs::IFile* file_;
+    size_t size_ = 0;
+};
+
+class BodyReader;
+
+// Streaming multipart/form-data parser. The body can be fed in pieces of any
+// size and each part goes to its sink as it arrives, so memory use stays at
+// the caller's read buffer plus one part's headers. The boundary search keeps
+// its match state across pieces and never looks at a byte twice.
+class MultipartParser {
+public:
+    // Picks where a part goes; nullptr skips it. The caller owns the sink.
+    using SinkFactory = std::function<PartSink*(const PartInfo&)>;
+
+    static constexpr size_t max_part_head = 8192;
+
+    MultipartParser(std::string_view boundary, SinkFactory sinks);
+
+    // The boundary parameter of a multipart/form-data Content-Type
+    static std::optional<std::string_view> boundary(std::string_view content_type);
+
+    // Returns false on malformed input or when a sink fails
+    bool feed(const char* data, size_t len);
+
+    // Pulls a streamed body through one fixed buffer until it ends
+    bool parse(BodyReader& reader);
+
+    bool done() const { return state_ == State::Done; }
+
+private:
+    enum class State {
+        Preamble,
+        AfterBoundary,
+        AfterBoundaryDash,
+        AfterBoundaryCR,
+        Headers,
+        Body,
+        Done
+    };
+
+    std::string delimiter_;          // CRLF "--" boundary
+    std::vector<size_t> failure_;    // KMP failure function of delimiter_
+    SinkFactory sinks_;
+    State state_ = State::Preamble;
+    size_t match_;                   // delimiter bytes matched, maybe over several feeds
+    size_t carry_;                   // of those, how many came with earlier feeds
+    std::string head_;
+    PartSink* sink_ = nullptr;
+    bool failed_ = false;
+
+    size_t scan(const char* data, size_t len, bool& found);
+    bool emit(const char* data, size_t len);
+    bool begin_part(const phr_header* headers, size_t num_headers);
+};
+
+}
@@ -1,88 +1,281 @@
 #include "parser.hpp"
-#include "picohttpparser.h"
+#include <cstdint>
 #include <cstring>
 #include <algorithm>
 
 namespace solder {
 
-HttpParser::HttpParser() : buffer_size_(8192) {
-    buffer_.resize(buffer_size_);
+namespace {
+
+// Returns false for a malformed value
+bool parse_content_length(std::string_view value, size_t& length) {
+    if (value.empty()) return false;
+    length = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') return false;
+        if (length > (SIZE_MAX - 9) / 10) return false;
+        length = length * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Only plain chunked is accepted. Any coding before it would have to be
+// undone before the handler sees the body, which nothing here does, so
+// "gzip, chunked" is rejected along with everything else.
+bool is_chunked(std::string_view value) {
+    size_t start = 0;
+    bool found = false;
+    while (start <= value.size()) {
+        size_t comma = std::min(value.find(',', start), value.size());
+        std::string_view coding = value.substr(start, comma - start);
+        while (!coding.empty() && (coding.front() == ' ' || coding.front() == '\t')) coding.remove_prefix(1);
+        while (!coding.empty() && (coding.back() == ' ' || coding.back() == '\t')) coding.remove_suffix(1);
+        if (!coding.empty()) {
+            if (found || !iequals(coding, "chunked")) return false;
+            found = true;
+        }
+        start = comma + 1;
+    }
+    return found;
+}
+
 }
 
-bool HttpParser::parse_request(const char* data, size_t len, Req& request) {
-    // Append new data to buffer
-    if (buffer_pos_ + len > buffer_size_) {
-        buffer_size_ = std::max(buffer_size_ * 2, buffer_pos_ + len);
-        buffer_.resize(buffer_size_);
+HttpParser::HttpParser() : buffer_(new char[8192]), buffer_size_(8192) {}
+
+void HttpParser::set_limits(size_t max_head, size_t max_body) {
+    max_head_ = max_head;
+    max_body_ = max_body;
+}
+
+iovec HttpParser::prepare(size_t min_size) {
+    if (parse_pos_ == buffer_pos_) {
+        // Everything was handed out already, start over without copying
+        buffer_pos_ = 0;
+        parse_pos_ = 0;
+    }
+
+    if (buffer_size_ - buffer_pos_ < min_size) {
+        // Only a partial request is ever left behind to be moved
+        size_t pending = buffer_pos_ - parse_pos_;
+        if (buffer_size_ - pending >= min_size) {
+            std::memmove(buffer_.get(), buffer_.get() + parse_pos_, pending);
+        } else {
+            buffer_size_ = std::max(buffer_size_ * 2, pending + min_size);
+            std::unique_ptr<char[]> grown(new char[buffer_size_]);
+            std::memcpy(grown.get(), buffer_.get() + parse_pos_, pending);
+            buffer_ = std::move(grown);
+        }
+        buffer_pos_ = pending;
+        parse_pos_ = 0;
     }
-    std::memcpy(buffer_.data() + buffer_pos_, data, len);
+
+    return {buffer_.get() + buffer_pos_, buffer_size_ - buffer_pos_};
+}
+
+void HttpParser::commit(size_t len) {
     buffer_pos_ += len;
+}
+
+void HttpParser::feed(const char* data, size_t len) {
+    iovec space = prepare(len);
+    std::memcpy(space.iov_base, data, len);
+    commit(len);
+}
+
+ParseStatus HttpParser::next(Req& request) {
+    if (parse_pos_ == buffer_pos_ || state_ == State::Stream) {
+        return ParseStatus::Incomplete;
+    }
+
+    char* data = buffer_.get() + parse_pos_;
 
-    // Try to parse
+    if (state_ == State::Head) {
+        size_t len = buffer_pos_ - parse_pos_;
+        int pret = parse_head(data, len, request);
+
+        if (pret == -1) {
+            return fail(400);
+        }
+        if (pret < 0) {
+            if (len > max_head_) return fail(431);
+            last_len_ = len;
+            return ParseStatus::Incomplete;
+        }
+        head_len_ = pret;
+        last_len_ = 0;
+
+        // Work out the body framing; without either header a request has
+        // no body, so whatever follows is the next pipelined request
+        bool has_length = false;
+        bool chunked = false;
+        body_len_ = 0;
+        for (size_t i = 0; i < request.headers.size(); ++i) {
+            const HeaderView& header = request.headers[i];
+            Header id = request.headers.id(i);
+            if (id == Header::ContentLength) {
+                if (has_length || !parse_content_length(header.value, body_len_)) {
+                    return fail(400);
+                }
+                has_length = true;
+            } else if (id == Header::TransferEncoding) {
+                // A second line would be chunked applied twice
+                if (chunked || !is_chunked(header.value)) {
+                    return fail(400);
+                }
+                chunked = true;
+            }
+        }
+
+        chunked_ = chunked;
+        if (chunked) {
+            // Both framings at once is a request smuggling vector
+            if (has_length) {
+                return fail(400);
+            }
+            // Nothing is decoded before the caller had a chance to stream
+            std::memset(&chunked_decoder_, 0, sizeof(chunked_decoder_));
+            chunked_decoder_.consume_trailer = 1;
+            state_ = State::Chunked;
+            return ParseStatus::Head;
+        } else if (len - head_len_ >= body_len_) {
+            // Fast path: the whole request arrived with its head
+            request.body = std::string_view(data + head_len_, body_len_);
+            parse_pos_ += head_len_ + body_len_;
+            return ParseStatus::Complete;
+        } else {
+            state_ = State::Body;
+            return ParseStatus::Head;
+        }
+    }
+
+    if (state_ == State::Body) {
+        // Asked to buffer it, so it has to fit
+        if (body_len_ > max_body_) return fail(413);
+        if (buffer_pos_ - parse_pos_ - head_len_ < body_len_) {
+            return ParseStatus::Incomplete;
+        }
+        return complete(data, request);
+    }
+
+    // Decode only the bytes that arrived since the last call, in place: the
+    // decoded body grows right after the head and the framing is dropped
+    size_t decoded_pos = parse_pos_ + head_len_ + body_len_;
+    size_t size = buffer_pos_ - decoded_pos;
+    ssize_t dret = phr_decode_chunked(&chunked_decoder_, buffer_.get() + decoded_pos, &size);
+    if (dret == -1) {
+        return fail(400);
+    }
+    body_len_ += size;
+    if (body_len_ > max_body_) return fail(413);
+    if (dret == -2) {
+        buffer_pos_ = decoded_pos + size;
+        return ParseStatus::Incomplete;
+    }
+    // The decoder moved any pipelined tail to just after the body
+    buffer_pos_ = decoded_pos + size + dret;
+    return complete(data, request);
+}
+
+int HttpParser::parse_head(const char* data, size_t len, Req& request) {
     const char* method;
     size_t method_len;
     const char* path;
     size_t path_len;
     int minor_version;
-    struct phr_header headers[64];
+    struct phr_header headers[ReqHeaders::capacity];
     size_t num_headers = sizeof(headers) / sizeof(headers[0]);
 
     int pret = phr_parse_request(
-        buffer_.data(), buffer_pos_,
+        data, len,
         &method, &method_len,
         &path, &path_len,
         &minor_version,
         headers, &num_headers,
         last_len_
     );
+    if (pret < 0) {
+        return pret;
+    }
 
-    if (pret > 0) {
-        // Successfully parsed
-        request.method.assign(method, method_len);
+    // Successfully parsed; the request only borrows from buffer_
+    request.method = std::string_view(method, method_len);
+    request.method_id = parse_method(request.method);
 
-        // Parse path and query
-        std::string full_path(path, path_len);
-        auto question_pos = full_path.find('?');
-        if (question_pos != std::string::npos) {
-            request.path = full_path.substr(0, question_pos);
-            request.query = full_path.substr(question_pos + 1);
-        } else {
-            request.path = full_path;
-        }
+    // Parse path and query
+    std::string_view full_path(path, path_len);
+    auto question_pos = full_path.find('?');
+    if (question_pos != std::string_view::npos) {
+        request.path = full_path.substr(0, question_pos);
+        request.query = full_path.substr(question_pos + 1);
+    } else {
+        request.path = full_path;
+        request.query = {};
+    }
+
+    request.minor_version = minor_version;
 
-        request.minor_version = minor_version;
+    // Parse headers
+    request.headers.clear();
+    for (size_t i = 0; i < num_headers; ++i) {
+        request.headers.add(
+            std::string_view(headers[i].name, headers[i].name_len),
+            std::string_view(headers[i].value, headers[i].value_len)
+        );
+    }
+    request.body = {};
 
-        // Parse headers
-        for (size_t i = 0; i < num_headers; ++i) {
+    return pret;
+}
 
-            request.headers.emplace(
-    std::piecewise_construct,
-    std::forward_as_tuple(headers[i].name, headers[i].name_len),
-    std::forward_as_tuple(headers[i].value, headers[i].value_len)
-);
+ParseStatus HttpParser::complete(const char* data, Req& request) {
+    // The buffer may have moved while the body was arriving, so the head is
+    // parsed once more to point the request at its current location
+    last_len_ = 0;
+    parse_head(data, head_len_, request);
+    request.body = std::string_view(data + head_len_, body_len_);
 
-        }
+    parse_pos_ += head_len_ + body_len_;
+    state_ = State::Head;
+    return ParseStatus::Complete;
+}
 
-        // Parse body if present
-        size_t body_start = pret;
-        if (body_start < buffer_pos_) {
-            request.body.assign(buffer_.data() + body_start, buffer_pos_ - body_start);
-        }
+ParseStatus HttpParser::fail(int status) {
+    reset();
+    error_status_ = status;
+    return ParseStatus::Error;
+}
 
-        reset();
-        return true;
-    } else if (pret == -1) {
-        reset();
-        return false;
-    }
+void HttpParser::begin_body() {
+    state_ = State::Stream;
+    stream_pos_ = parse_pos_ + head_len_;
+}
+
+std::string_view HttpParser::take_buffered(size_t max) {
+    size_t len = std::min(max, buffer_pos_ - stream_pos_);
+    std::string_view taken(buffer_.get() + stream_pos_, len);
+    stream_pos_ += len;
+    return taken;
+}
 
-    last_len_ = buffer_pos_;
-    return false;
+void HttpParser::untake(size_t len) {
+    stream_pos_ -= len;
+}
+
+void HttpParser::end_body(std::string_view leftover) {
+    parse_pos_ = stream_pos_;
+    state_ = State::Head;
+    last_len_ = 0;
+    if (!leftover.empty()) {
+        feed(leftover.data(), leftover.size());
+    }
 }
 
 void HttpParser::reset() {
     buffer_pos_ = 0;
+    parse_pos_ = 0;
     last_len_ = 0;
+    state_ = State::Head;
 }
 
 }
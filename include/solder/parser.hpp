@@ -1,22 +1,89 @@
 #pragma once
 #include "http_types.hpp"
-#include <vector>
+#include "picohttpparser.h"
+#include <cstdint>
+#include <memory>
+#include <sys/uio.h>
 
 namespace solder {
 
+enum class ParseStatus {
+    Complete,
+    Head,       // head parsed, body still arriving; next() goes on buffering it
+    Incomplete,
+    Error
+};
+
 class HttpParser {
 public:
     HttpParser();
 
-    bool parse_request(const char* data, size_t len, Req& request);
+    // Past `max_head` unparsed head bytes, or a body next() is asked to
+    // buffer past `max_body` bytes, next() returns Error (see error_status)
+    void set_limits(size_t max_head, size_t max_body);
+
+    // Writable space of at least `min_size` bytes after the buffered data,
+    // for recv to land in directly. Finish with commit().
+    iovec prepare(size_t min_size);
+    void commit(size_t len);
+
+    // Append bytes that were received elsewhere (copies them in).
+    void feed(const char* data, size_t len);
+
+    // Parse the next buffered request. On Complete, `request` borrows from
+    // the parser's buffer until the next call to prepare(); call next() again
+    // to pick up further pipelined requests from the same buffer.
+    // Head is returned once per request whose body has not fully arrived,
+    // with every field but the body filled in, so the caller can choose to
+    // stream the body instead.
+    ParseStatus next(Req& request);
+    // What to answer the last Error with: 400, 413 or 431
+    int error_status() const { return error_status_; }
+
+    // Streaming a body after next() returned Head (see BodyReader). The
+    // head stays where it is until end_body(), so the request remains valid.
+    void begin_body();
+    bool body_chunked() const { return chunked_; }
+    size_t body_length() const { return body_len_; }
+    // Up to `max` raw body bytes that are already buffered
+    std::string_view take_buffered(size_t max);
+    bool has_buffered() const { return stream_pos_ < buffer_pos_; }
+    // Give back the last `len` bytes taken, which turned out to follow the body
+    void untake(size_t len);
+    // Resume parsing after the body; `leftover` holds bytes read past it
+    void end_body(std::string_view leftover);
 
     void reset();
 
 private:
-    std::vector<char> buffer_;
+    enum class State {
+        Head,
+        Body,
+        Chunked,
+        Stream
+    };
+
+    // Left uninitialized on purpose; only [0, buffer_pos_) is ever read
+    std::unique_ptr<char[]> buffer_;
     size_t buffer_size_;
     size_t buffer_pos_ = 0;
+    size_t parse_pos_ = 0;
     size_t last_len_ = 0;
+    size_t max_head_ = 64 * 1024;
+    size_t max_body_ = SIZE_MAX;
+    int error_status_ = 400;
+
+    // Framing of the request at parse_pos_, kept across feed() calls
+    State state_ = State::Head;
+    size_t head_len_ = 0;
+    size_t body_len_ = 0;   // Content-Length, or bytes decoded so far when chunked
+    bool chunked_ = false;
+    size_t stream_pos_ = 0;
+    phr_chunked_decoder chunked_decoder_;
+
+    int parse_head(const char* data, size_t len, Req& request);
+    ParseStatus complete(const char* data, Req& request);
+    ParseStatus fail(int status);
 };
 
 }
@@ -27,12 +27,10 @@
 #include <assert.h>
 #include <stddef.h>
 #include <string.h>
-#ifdef __SSE4_2__
-#ifdef _MSC_VER
-#include <nmmintrin.h>
-#else
-#include <x86intrin.h>
-#endif
+/* SSE4.2 and AVX2 scanners are compiled in regardless of -m flags and picked at runtime by CPUID, so the object stays portable */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PHR_SIMD_DISPATCH 1
+#include <immintrin.h>
 #endif
 #include "picohttpparser.h"
 
@@ -102,10 +100,25 @@ static const char *token_char_map = "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\
                                     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
                                     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
 
-static const char *findchar_fast(const char *buf, const char *buf_end, const char *ranges, size_t ranges_size, int *found)
+/* returns the first byte within `ranges` at or after `buf`, setting `*found`; may stop early without finding one, leaving the
+ * rest of the buffer to the caller's byte loop */
+typedef const char *(*findchar_fn)(const char *buf, const char *buf_end, const char *ranges, size_t ranges_size, int *found);
+
+static const char *findchar_scalar(const char *buf, const char *buf_end, const char *ranges, size_t ranges_size, int *found)
+{
+    *found = 0;
+    /* suppress unused parameter warning */
+    (void)buf_end;
+    (void)ranges;
+    (void)ranges_size;
+    return buf;
+}
+
+#ifdef PHR_SIMD_DISPATCH
+__attribute__((target("sse4.2"))) static const char *findchar_sse42(const char *buf, const char *buf_end, const char *ranges,
+                                                                    size_t ranges_size, int *found)
 {
     *found = 0;
-#if __SSE4_2__
     if (likely(buf_end - buf >= 16)) {
         __m128i ranges16 = _mm_loadu_si128((const __m128i *)ranges);
 
@@ -122,53 +135,146 @@ static const char *findchar_fast(const char *buf, const char *buf_end, const cha
             left -= 16;
         } while (likely(left != 0));
     }
+    return buf;
+}
+
+/* AVX2 has no range compare like pcmpestri; each [lo, hi] pair is tested as max(b, lo) == b && min(b, hi) == b, which only pays
+ * off for the two or three ranges of paths and header values. Token scans, with eight ranges and mostly short input, keep using
+ * pcmpestri. */
+__attribute__((target("avx2"), always_inline)) static inline const char *findchar_avx2_n(const char *buf, const char *buf_end,
+                                                                                         const char *ranges, const size_t num_ranges,
+                                                                                         int *found)
+{
+    __m256i lo[3], hi[3];
+    size_t i;
+
+    for (i = 0; i != num_ranges; ++i) {
+        lo[i] = _mm256_set1_epi8(ranges[i * 2]);
+        hi[i] = _mm256_set1_epi8(ranges[i * 2 + 1]);
+    }
+    while (buf_end - buf >= 16) {
+        /* take 32 bytes when there are, else one last 16-byte step before leaving the rest to the byte loop */
+        int wide = buf_end - buf >= 32;
+        __m256i b = wide ? _mm256_loadu_si256((const __m256i *)buf) : _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)buf));
+        __m256i match = _mm256_setzero_si256();
+        for (i = 0; i != num_ranges; ++i) {
+            __m256i ge_lo = _mm256_cmpeq_epi8(_mm256_max_epu8(b, lo[i]), b);
+            __m256i le_hi = _mm256_cmpeq_epi8(_mm256_min_epu8(b, hi[i]), b);
+            match = _mm256_or_si256(match, _mm256_and_si256(ge_lo, le_hi));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_epi8(match);
+        if (!wide)
+            mask &= 0xffff;
+        if (unlikely(mask != 0)) {
+            *found = 1;
+            return buf + __builtin_ctz(mask);
+        }
+        buf += wide ? 32 : 16;
+    }
+    return buf;
+}
+
+__attribute__((target("avx2"))) static const char *findchar_avx2(const char *buf, const char *buf_end, const char *ranges,
+                                                                  size_t ranges_size, int *found)
+{
+    *found = 0;
+    if (buf_end - buf < 16)
+        return buf;
+    /* most values end within 16 bytes, where a single pcmpestri beats setting up the AVX2 ranges */
+    __m128i ranges16 = _mm_loadu_si128((const __m128i *)ranges);
+    int r = _mm_cmpestri(ranges16, ranges_size, _mm_loadu_si128((const __m128i *)buf), 16,
+                         _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+    if (r != 16) {
+        *found = 1;
+        return buf + r;
+    }
+    buf += 16;
+    switch (ranges_size / 2) {
+    case 2:
+        return findchar_avx2_n(buf, buf_end, ranges, 2, found);
+    case 3:
+        return findchar_avx2_n(buf, buf_end, ranges, 3, found);
+    default:
+        return findchar_sse42(buf, buf_end, ranges, ranges_size, found);
+    }
+}
+#endif
+
+static int simd_level = PHR_SIMD_SCALAR;
+static findchar_fn findchar_fast = findchar_scalar;
+
+int phr_simd_level(void)
+{
+    return simd_level;
+}
+
+int phr_set_simd_level(int level)
+{
+#ifdef PHR_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if (level >= PHR_SIMD_AVX2 && __builtin_cpu_supports("avx2")) {
+        simd_level = PHR_SIMD_AVX2;
+        findchar_fast = findchar_avx2;
+        return simd_level;
+    }
+    if (level >= PHR_SIMD_SSE42 && __builtin_cpu_supports("sse4.2")) {
+        simd_level = PHR_SIMD_SSE42;
+        findchar_fast = findchar_sse42;
+        return simd_level;
+    }
 #else
-    /* suppress unused parameter warning */
-    (void)buf_end;
-    (void)ranges;
-    (void)ranges_size;
+    (void)level;
 #endif
-    return buf;
+    simd_level = PHR_SIMD_SCALAR;
+    findchar_fast = findchar_scalar;
+    return simd_level;
 }
 
+#if defined(__GNUC__)
+__attribute__((constructor)) static void select_findchar(void)
+{
+    phr_set_simd_level(PHR_SIMD_AVX2);
+}
+#endif
+
 static const char *get_token_to_eol(const char *buf, const char *buf_end, const char **token, size_t *token_len, int *ret)
 {
     const char *token_start = buf;
 
-#ifdef __SSE4_2__
-    static const char ALIGNED(16) ranges1[16] = "\0\010"    /* allow HT */
-                                                "\012\037"  /* allow SP and up to but not including DEL */
-                                                "\177\177"; /* allow chars w. MSB set */
-    int found;
-    buf = findchar_fast(buf, buf_end, ranges1, 6, &found);
-    if (found)
-        goto FOUND_CTL;
-#else
-    /* find non-printable char within the next 8 bytes, this is the hottest code; manually inlined */
-    while (likely(buf_end - buf >= 8)) {
+    if (simd_level != PHR_SIMD_SCALAR) {
+        static const char ALIGNED(16) ranges1[16] = "\0\010"    /* allow HT */
+                                                    "\012\037"  /* allow SP and up to but not including DEL */
+                                                    "\177\177"; /* allow chars w. MSB set */
+        int found;
+        buf = findchar_fast(buf, buf_end, ranges1, 6, &found);
+        if (found)
+            goto FOUND_CTL;
+    } else {
+        /* find non-printable char within the next 8 bytes, this is the hottest code; manually inlined */
+        while (likely(buf_end - buf >= 8)) {
 #define DOIT()                                                                                                                     \
     do {                                                                                                                           \
         if (unlikely(!IS_PRINTABLE_ASCII(*buf)))                                                                                   \
             goto NonPrintable;                                                                                                     \
         ++buf;                                                                                                                     \
     } while (0)
-        DOIT();
-        DOIT();
-        DOIT();
-        DOIT();
-        DOIT();
-        DOIT();
-        DOIT();
-        DOIT();
+            DOIT();
+            DOIT();
+            DOIT();
+            DOIT();
+            DOIT();
+            DOIT();
+            DOIT();
+            DOIT();
 #undef DOIT
-        continue;
-    NonPrintable:
-        if ((likely((unsigned char)*buf < '\040') && likely(*buf != '\011')) || unlikely(*buf == '\177')) {
-            goto FOUND_CTL;
+            continue;
+        NonPrintable:
+            if ((likely((unsigned char)*buf < '\040') && likely(*buf != '\011')) || unlikely(*buf == '\177')) {
+                goto FOUND_CTL;
+            }
+            ++buf;
         }
-        ++buf;
     }
-#endif
     for (;; ++buf) {
         CHECK_EOF();
         if (unlikely(!IS_PRINTABLE_ASCII(*buf))) {
@@ -83,6 +83,15 @@ ssize_t phr_decode_chunked(struct phr_chunked_decoder *decoder, char *buf, size_
 /* returns if the chunked decoder is in middle of chunked data */
 int phr_decode_chunked_is_in_data(struct phr_chunked_decoder *decoder);
 
+/* header scanning implementations; the best one the CPU supports is picked at load time */
+enum { PHR_SIMD_SCALAR = 0, PHR_SIMD_SSE42 = 1, PHR_SIMD_AVX2 = 2 };
+
+/* returns the implementation in use */
+int phr_simd_level(void);
+
+/* uses the best implementation up to `level` that the CPU supports and returns it; not thread-safe, call it before parsing */
+int phr_set_simd_level(int level);
+
 #ifdef __cplusplus
 }
 #endif
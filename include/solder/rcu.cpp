@@ -0,0 +1,61 @@
+#include "rcu.hpp"
+#include <photon/common/rcuptr.h>
+#include <photon/thread/thread.h>
+#include <atomic>
+
+namespace solder {
+
+namespace {
+
+// Photon's readers store the grace period they were last seen in, with 0
+// meaning offline. A domain's count starts at 0 too, so readers online
+// before its first grace period would look offline; this one starts at 1.
+struct Domain : RCUDomain {
+    Domain() { ctr.store(1); }
+};
+
+Domain* domain() {
+    static Domain instance;
+    return &instance;
+}
+
+}
+
+void rcu_online() {
+    domain()->reader->online();
+    // The loads the caller makes next must not be ordered before the
+    // store above, or a writer could see us offline while we read
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void rcu_offline() {
+    domain()->reader->offline();
+}
+
+void rcu_synchronize() {
+    // RCUDomain::synchronize() passes over readers seen in the grace period
+    // just closed, which may still hold the old object. Readers that went
+    // online after this increment load the new one, so only those behind
+    // it are waited for.
+    uint64_t gp = domain()->ctr.fetch_add(1, std::memory_order_acq_rel) + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (true) {
+        bool passed = true;
+        {
+            SCOPED_LOCK(domain()->tlock);
+            for (RCUReader* reader : domain()->tlist) {
+                uint64_t seen = reader->get_gp();
+                if (seen != 0 && seen < gp) {
+                    passed = false;
+                    break;
+                }
+            }
+        }
+        if (passed) {
+            return;
+        }
+        photon::thread_usleep(1000);
+    }
+}
+
+}
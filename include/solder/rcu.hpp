@@ -0,0 +1,28 @@
+#pragma once
+
+#include <photon/thread/thread11.h>
+
+namespace solder {
+
+// Grace periods for objects photon threads read without a lock. A reader
+// goes online before it loads a shared pointer and offline once it holds
+// nothing it loaded. A writer that swapped such a pointer frees the old
+// object only after every reader that was online at the swap has gone
+// offline or online again.
+void rcu_online();
+void rcu_offline();
+
+// Waits out a grace period. Call from a photon thread that is offline.
+void rcu_synchronize();
+
+// Deletes `old` after a grace period, from a photon thread of its own, so
+// the caller may be a reader still using it
+template <typename T>
+void rcu_retire(T* old) {
+    photon::thread_create11([old] {
+        rcu_synchronize();
+        delete old;
+    });
+}
+
+}
@@ -0,0 +1,143 @@
+#include "response_cache.hpp"
+#include <photon/common/utility.h>
+#include <photon/thread/thread.h>
+#include <unordered_map>
+
+namespace solder {
+
+struct ResponseCache::Entry {
+    std::shared_ptr<const StaticResponse> response;
+    uint64_t expires_at;
+    size_t bytes;
+    std::shared_ptr<std::atomic<size_t>> used;
+
+    ~Entry() { used->fetch_sub(bytes); }
+};
+
+// Shared by the workers on every vcpu. The spinlock is never held across
+// a yield: a computing request marks its slot and drops the lock, and the
+// ones that want the same key poll until it is filled.
+struct ResponseCache::Store {
+    struct Slot {
+        std::shared_ptr<Entry> entry;
+        bool computing = false;
+        uint64_t last_used = 0;
+    };
+
+    photon::spinlock lock;
+    std::unordered_map<std::string, Slot> slots;
+    uint64_t next_sweep = 0;
+
+    // Ends a computation; an answer that could not be cached is dropped
+    // along with any old one, so the next request computes it again
+    void settle(const std::string& key, std::shared_ptr<Entry> entry, uint64_t ttl) {
+        SCOPED_LOCK(lock);
+        if (entry) {
+            Slot& slot = slots[key];
+            slot.entry = std::move(entry);
+            slot.computing = false;
+        } else {
+            slots.erase(key);
+        }
+        sweep(ttl);
+    }
+
+    // Slots nobody asked for within a ttl go, checked at most once per ttl
+    void sweep(uint64_t ttl) {
+        uint64_t now = photon::now;
+        if (now < next_sweep) return;
+        next_sweep = now + ttl;
+        for (auto it = slots.begin(); it != slots.end();) {
+            if (!it->second.computing && it->second.last_used + ttl < now) {
+                it = slots.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+};
+
+ResponseCache::ResponseCache(const CacheOptions& options)
+    : options_(options), used_(std::make_shared<std::atomic<size_t>>(0)), store_(std::make_unique<Store>()) {}
+
+ResponseCache::~ResponseCache() = default;
+
+std::string ResponseCache::make_key(const Req& request, std::string_view variant) const {
+    // Fields joined by '\0', which none of them can contain
+    std::string key;
+    key.reserve(request.method.size() + request.path.size() + 32);
+    key.append(request.method).push_back('\0');
+    key.append(request.path).push_back('\0');
+    key.append(variant);
+
+    std::string scratch;
+    for (const std::string& name : options_.query_params) {
+        key.push_back('\0');
+        if (auto value = request.query_param(name, scratch)) {
+            key.push_back('=');
+            key.append(*value);
+        }
+    }
+    for (const std::string& name : options_.headers) {
+        key.push_back('\0');
+        if (request.has_header(name)) {
+            key.push_back('=');
+            key.append(request.get_header(name));
+        }
+    }
+    return key;
+}
+
+ResponseCache::Entry* ResponseCache::make_entry(const Res& response, bool etags) {
+    if (response.status_code != 200 || response.has_file()) {
+        return nullptr;
+    }
+
+    auto rendered = std::make_shared<const StaticResponse>(response, etags);
+    size_t bytes = rendered->head.size() + rendered->tail.size();
+    if (used_->fetch_add(bytes) + bytes > options_.max_bytes) {
+        used_->fetch_sub(bytes);
+        return nullptr;
+    }
+    return new Entry{std::move(rendered), photon::now + options_.ttl, bytes, used_};
+}
+
+std::shared_ptr<const StaticResponse> ResponseCache::get(const Req& request, const std::function<Res()>& compute,
+                                                         Res& computed, std::string_view variant, bool etags) {
+    if (request.method_id != Method::Get && request.method_id != Method::Head) {
+        computed = compute();
+        return nullptr;
+    }
+
+    std::string key = make_key(request, variant);
+    for (;;) {
+        {
+            SCOPED_LOCK(store_->lock);
+            Store::Slot& slot = store_->slots[key];
+            slot.last_used = photon::now;
+            if (slot.entry) {
+                // Only the first request to see it expired refreshes it
+                if (photon::now < slot.entry->expires_at || slot.computing) {
+                    return slot.entry->response;
+                }
+                slot.computing = true;
+                break;
+            }
+            if (!slot.computing) {
+                slot.computing = true;
+                break;
+            }
+        }
+        // Another request is computing it
+        photon::thread_yield();
+    }
+
+    // The computing request keeps its answer even if it is not cached
+    std::shared_ptr<Entry> fresh;
+    DEFER(store_->settle(key, fresh, options_.ttl));
+    computed = compute();
+    fresh.reset(make_entry(computed, etags));
+    return fresh ? fresh->response : nullptr;
+}
+
+}
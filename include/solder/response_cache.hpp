@@ -0,0 +1,60 @@
+#pragma once
+
+#include "http_types.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace solder {
+
+struct CacheOptions {
+    // How long an answer is reused, in microseconds; 0 disables caching
+    uint64_t ttl = 0;
+    // Answers are not cached once this many bytes are held
+    size_t max_bytes = 16 * 1024 * 1024;
+    // Query parameters and request headers that change the answer
+    std::vector<std::string> query_params;
+    std::vector<std::string> headers;
+};
+
+// Serialized 200 answers of one GET route, kept for CacheOptions::ttl.
+// Only one request computes a missing key; the others wait for it. An
+// expired entry is recomputed by one request while the rest keep getting
+// the old answer until the new one is in.
+class ResponseCache {
+public:
+    explicit ResponseCache(const CacheOptions& options);
+    ~ResponseCache();
+
+    // The cached answer to `request`, calling `compute` when there is none.
+    // An answer that cannot be cached is left in `computed` and nullptr is
+    // returned. Each `variant` (such as the content coding `compute`
+    // applies) is kept apart. With `etags`, answers are stored with an
+    // ETag and a 304 to go with it.
+    std::shared_ptr<const StaticResponse> get(const Req& request, const std::function<Res()>& compute,
+                                              Res& computed, std::string_view variant = {},
+                                              bool etags = true);
+
+    // Bytes of answers held right now
+    size_t size() const { return used_->load(); }
+
+private:
+    struct Entry;
+    struct Store;
+
+    CacheOptions options_;
+    // Outlives the store, as entries give their bytes back when destroyed
+    std::shared_ptr<std::atomic<size_t>> used_;
+    // No timer or photon thread of its own, so it can be made and freed on
+    // any thread, such as one retiring an old router
+    std::unique_ptr<Store> store_;
+
+    std::string make_key(const Req& request, std::string_view variant) const;
+    Entry* make_entry(const Res& response, bool etags);
+};
+
+}
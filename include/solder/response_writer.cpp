@@ -0,0 +1,162 @@
+#include "response_writer.hpp"
+#include "send_queue.hpp"
+#include <photon/common/alog.h>
+#include <cstdio>
+
+namespace solder {
+
+ResponseWriter::ResponseWriter(photon::net::ISocketStream* stream, bool chunked, bool head_only)
+    : stream_(stream), chunked_(chunked), head_only_(head_only) {
+    head_.headers["Content-Type"] = "application/octet-stream";
+}
+
+void ResponseWriter::compress_with(ContentCoding coding, const CompressionOptions& options) {
+    coding_ = coding;
+    compression_ = &options;
+}
+
+void ResponseWriter::status(int code) {
+    head_.status_code = code;
+    head_.status_text = reason_phrase(code);
+}
+
+void ResponseWriter::header(std::string name, std::string value) {
+    head_.headers.set(name, std::move(value));
+}
+
+bool ResponseWriter::write(std::string_view data) {
+    if (failed_ || ended_) return false;
+    if (buffer_.size() + data.size() <= buffer_limit) {
+        buffer_.append(data);
+        return true;
+    }
+    // Large pieces go out in the same frame as what is gathered, uncopied
+    return send(data, Deflater::Flush::None);
+}
+
+bool ResponseWriter::flush() {
+    if (failed_ || ended_) return false;
+    return send({}, Deflater::Flush::Sync);
+}
+
+bool ResponseWriter::end() {
+    if (failed_) return false;
+    if (ended_) return true;
+    ended_ = true;
+
+    if (!head_sent_) {
+        // Everything fit in the buffer, so this is an ordinary response
+        head_.body = std::move(buffer_);
+        if (compression_) {
+            compress_response(head_, coding_, *compression_);
+        }
+        std::string response;
+        if (head_only_) {
+            head_.append_head_to(response);
+        } else {
+            head_.append_to(response);
+        }
+        iovec iov = {response.data(), response.size()};
+        if (!send_iov(stream_, &iov, 1)) {
+            LOG_DEBUG("Failed to send streamed response, errno: ", errno);
+            failed_ = true;
+        }
+        return !failed_;
+    }
+    return send({}, Deflater::Flush::Finish);
+}
+
+void ResponseWriter::start_compression() {
+    if (!compression_->enabled || head_.status_code == 204 || head_.status_code == 304) {
+        return;
+    }
+    const std::string* content_type = head_.headers.find(Header::ContentType);
+    if (head_.headers.contains(Header::ContentEncoding) ||
+        (content_type && !compressible_type(*content_type, *compression_))) {
+        return;
+    }
+    // Whatever this client gets, another one may get a different form
+    vary_on_encoding(head_.headers);
+    if (coding_ == ContentCoding::Identity || head_only_) {
+        return;
+    }
+    deflater_ = Deflater::acquire(coding_, compression_->level);
+    head_.headers["Content-Encoding"] = coding_name(coding_);
+}
+
+bool ResponseWriter::send(std::string_view extra, Deflater::Flush flush) {
+    iovec iov[5];
+    int count = 0;
+    bool last = flush == Deflater::Flush::Finish;
+
+    if (!head_sent_) {
+        if (compression_) {
+            start_compression();
+        }
+        if (chunked_) {
+            head_.headers["Transfer-Encoding"] = "chunked";
+        } else {
+            head_.headers["Connection"] = "close";
+        }
+        head_.append_head_to(head_bytes_, false);
+        iov[count++] = {head_bytes_.data(), head_bytes_.size()};
+    }
+
+    if (head_only_) {
+        // Nothing after the head, not even the last chunk
+        buffer_.clear();
+        extra = {};
+        last = false;
+        if (count == 0) return true;
+    }
+
+    // Compressed output replaces the gathered bytes and `extra`; a write
+    // that zlib only buffered yields no frame at all
+    std::string_view data[2] = {buffer_, extra};
+    if (deflater_) {
+        compressed_.clear();
+        if (!deflater_->deflate(buffer_, compressed_, Deflater::Flush::None) ||
+            !deflater_->deflate(extra, compressed_, flush)) {
+            failed_ = true;
+            return false;
+        }
+        data[0] = compressed_;
+        data[1] = {};
+    }
+
+    // One frame for the data, then the last chunk
+    size_t size = data[0].size() + data[1].size();
+    char size_line[24];
+    static constexpr char crlf_last[] = "\r\n0\r\n\r\n";
+    if (chunked_ && size > 0) {
+        int len = std::snprintf(size_line, sizeof(size_line), "%zx\r\n", size);
+        iov[count++] = {size_line, static_cast<size_t>(len)};
+    }
+    for (std::string_view piece : data) {
+        if (!piece.empty()) iov[count++] = {const_cast<char*>(piece.data()), piece.size()};
+    }
+    if (chunked_) {
+        if (size > 0 && last) {
+            iov[count++] = {const_cast<char*>(crlf_last), sizeof(crlf_last) - 1};
+        } else if (size > 0) {
+            iov[count++] = {const_cast<char*>(crlf_last), 2};
+        } else if (last) {
+            iov[count++] = {const_cast<char*>(crlf_last + 2), sizeof(crlf_last) - 3};
+        }
+    }
+
+    head_sent_ = true;
+    if (!send_iov(stream_, iov, count)) {
+        LOG_DEBUG("Failed to send streamed response, errno: ", errno);
+        failed_ = true;
+        return false;
+    }
+    buffer_.clear();
+    head_bytes_.clear();
+    if (last) {
+        deflater_.reset();
+    }
+    return true;
+}
+
+}
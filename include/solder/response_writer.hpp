@@ -0,0 +1,79 @@
+#pragma once
+
+#include "compression.hpp"
+#include "http_types.hpp"
+#include <photon/net/socket.h>
+#include <string>
+#include <string_view>
+
+namespace solder {
+
+// Lets a handler send its response while it is still producing it. The
+// head goes out with the first flush, the body follows as
+// Transfer-Encoding: chunked frames (or until close for HTTP/1.0). Writes
+// block only the calling photon thread while the socket is backed up, so
+// a slow client holds back its own producer and nothing else.
+class ResponseWriter {
+public:
+    // Smaller writes are gathered into one chunk
+    static constexpr size_t buffer_limit = 16 * 1024;
+
+    // `head_only` answers HEAD: writes are taken but never sent
+    ResponseWriter(photon::net::ISocketStream* stream, bool chunked, bool head_only = false);
+
+    // Compress the body with `coding` if its Content-Type allows, frame by
+    // frame. The server sets this up from Accept-Encoding.
+    void compress_with(ContentCoding coding, const CompressionOptions& options);
+
+    // Only before the head is sent
+    void status(int code);
+    void header(std::string name, std::string value);
+
+    bool write(std::string_view data);
+
+    // Writes every piece a range yields, such as a photon Generator (see
+    // common/generator.h) whose values convert to std::string_view. Stops
+    // at the first failed write.
+    template <typename Range>
+    bool write_all(const Range& pieces) {
+        for (auto&& piece : pieces) {
+            if (!write(std::string_view(piece))) return false;
+        }
+        return true;
+    }
+
+    // Sends the head and whatever is gathered without waiting for more
+    bool flush();
+
+    // Ends the body. The server calls it for handlers that return without
+    // doing so. A response that never got flushed goes out with a plain
+    // Content-Length instead of chunks.
+    bool end();
+
+    bool head_sent() const { return head_sent_; }
+    bool ended() const { return ended_; }
+    bool failed() const { return failed_; }
+    // Whether the connection can carry another request afterwards
+    bool reusable() const { return !failed_ && ended_ && (chunked_ || !head_sent_); }
+
+private:
+    photon::net::ISocketStream* stream_;
+    Res head_;
+    std::string buffer_;
+    std::string head_bytes_;
+    bool chunked_;
+    bool head_only_;
+    bool head_sent_ = false;
+    bool ended_ = false;
+    bool failed_ = false;
+
+    ContentCoding coding_ = ContentCoding::Identity;
+    const CompressionOptions* compression_ = nullptr;
+    DeflaterPtr deflater_;
+    std::string compressed_;
+
+    void start_compression();
+    bool send(std::string_view extra, Deflater::Flush flush);
+};
+
+}
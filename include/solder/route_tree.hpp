@@ -0,0 +1,155 @@
+#pragma once
+
+#include "http_types.hpp"
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace solder {
+
+// Paths of one method in a compressed radix tree. A path may hold
+// ":name" segments, which match up to the next '/', and end in "*name"
+// (or a bare "*"), which matches the rest of the path, even if empty.
+// Static text wins over a parameter, which wins over a splat, so lookup
+// only backtracks where routes overlap. Its cost follows the path length,
+// not the number of routes.
+template <typename Value>
+class RouteTree {
+public:
+    // Replaces the value of a path that is already there. Throws
+    // std::invalid_argument when a parameter is named differently from one
+    // registered at the same position, or when anything follows a splat's
+    // name.
+    void insert(std::string_view path, Value value) {
+        size_t splat = path.find('*');
+        if (splat != std::string_view::npos && path.find_first_of("/:*", splat + 1) != std::string_view::npos) {
+            throw std::invalid_argument("Nothing can follow a splat: " + std::string(path));
+        }
+
+        Node* node = &root_;
+        while (true) {
+            size_t special = path.find_first_of(":*");
+            node = descend(node, path.substr(0, special));
+            if (special == std::string_view::npos) break;
+            path.remove_prefix(special);
+
+            if (path[0] == '*') {
+                set_name(node->splat_name, path.substr(1), node->splat != nullptr, "*");
+                if (!node->splat) node->splat = std::make_unique<Node>();
+                node = node->splat.get();
+                break;
+            }
+
+            size_t end = path.find('/');
+            set_name(node->param_name, path.substr(1, end == std::string_view::npos ? end : end - 1),
+                     node->param != nullptr, ":");
+            if (!node->param) node->param = std::make_unique<Node>();
+            node = node->param.get();
+            if (end == std::string_view::npos) break;
+            path.remove_prefix(end);
+        }
+        node->value = std::move(value);
+        node->has_value = true;
+    }
+
+    // The value for `path`, with parameter values added to `params`
+    const Value* find(std::string_view path, PathParams& params) const {
+        return match(&root_, path, params);
+    }
+
+    void clear() { root_ = Node(); }
+
+private:
+    struct Node {
+        std::string prefix;
+        // First byte of each child's prefix, to pick one without comparing
+        std::string indices;
+        std::vector<std::unique_ptr<Node>> children;
+        std::string param_name;
+        std::unique_ptr<Node> param;    // after ":param_name"
+        std::string splat_name;
+        std::unique_ptr<Node> splat;    // after "*splat_name"
+        Value value{};
+        bool has_value = false;
+    };
+
+    Node root_;
+
+    static void set_name(std::string& current, std::string_view name, bool exists, const char* kind) {
+        if (exists && current != name) {
+            throw std::invalid_argument(std::string("Conflicting route parameters ") + kind + current +
+                                        " and " + kind + std::string(name));
+        }
+        current.assign(name);
+    }
+
+    // The node reached after `text` of static path below `node`, splitting
+    // an edge where `text` leaves it
+    static Node* descend(Node* node, std::string_view text) {
+        while (!text.empty()) {
+            size_t index = node->indices.find(text[0]);
+            if (index == std::string::npos) {
+                auto child = std::make_unique<Node>();
+                child->prefix.assign(text);
+                node->indices.push_back(text[0]);
+                node->children.push_back(std::move(child));
+                return node->children.back().get();
+            }
+
+            Node* child = node->children[index].get();
+            size_t common = 0;
+            size_t limit = std::min(child->prefix.size(), text.size());
+            while (common < limit && child->prefix[common] == text[common]) ++common;
+
+            if (common < child->prefix.size()) {
+                auto middle = std::make_unique<Node>();
+                middle->prefix.assign(child->prefix, 0, common);
+                child->prefix.erase(0, common);
+                middle->indices.push_back(child->prefix[0]);
+                middle->children.push_back(std::move(node->children[index]));
+                node->children[index] = std::move(middle);
+                child = node->children[index].get();
+            }
+            text.remove_prefix(common);
+            node = child;
+        }
+        return node;
+    }
+
+    static const Value* match(const Node* node, std::string_view path, PathParams& params) {
+        if (path.size() < node->prefix.size() || path.compare(0, node->prefix.size(), node->prefix) != 0) {
+            return nullptr;
+        }
+        path.remove_prefix(node->prefix.size());
+
+        if (path.empty() && node->has_value) {
+            return &node->value;
+        }
+        if (!path.empty()) {
+            size_t index = node->indices.find(path[0]);
+            if (index != std::string::npos) {
+                if (const Value* value = match(node->children[index].get(), path, params)) {
+                    return value;
+                }
+            }
+        }
+        if (node->param && !path.empty() && path[0] != '/') {
+            size_t end = std::min(path.find('/'), path.size());
+            size_t mark = params.size();
+            params.add(node->param_name, path.substr(0, end));
+            if (const Value* value = match(node->param.get(), path.substr(end), params)) {
+                return value;
+            }
+            params.truncate(mark);
+        }
+        if (node->splat && node->splat->has_value) {
+            params.add(node->splat_name, path);
+            return &node->splat->value;
+        }
+        return nullptr;
+    }
+};
+
+}
@@ -2,85 +2,296 @@
 
 namespace solder {
 
-void HttpRouter::get(const std::string& path, Handler handler) {
-    add_route("GET", path, std::move(handler));
+void HttpRouter::get(const std::string& path, Handler handler, RouteOptions options) {
+    add_route("GET", path, Route{std::move(handler), {}, options});
 }
 
-void HttpRouter::post(const std::string& path, Handler handler) {
-    add_route("POST", path, std::move(handler));
+void HttpRouter::post(const std::string& path, Handler handler, RouteOptions options) {
+    add_route("POST", path, Route{std::move(handler), {}, options});
 }
 
-void HttpRouter::put(const std::string& path, Handler handler) {
-    add_route("PUT", path, std::move(handler));
+void HttpRouter::put(const std::string& path, Handler handler, RouteOptions options) {
+    add_route("PUT", path, Route{std::move(handler), {}, options});
 }
 
-void HttpRouter::delete_(const std::string& path, Handler handler) {
-    add_route("DELETE", path, std::move(handler));
+void HttpRouter::delete_(const std::string& path, Handler handler, RouteOptions options) {
+    add_route("DELETE", path, Route{std::move(handler), {}, options});
 }
 
-void HttpRouter::patch(const std::string& path, Handler handler) {
-    add_route("PATCH", path, std::move(handler));
+void HttpRouter::patch(const std::string& path, Handler handler, RouteOptions options) {
+    add_route("PATCH", path, Route{std::move(handler), {}, options});
 }
 
-void HttpRouter::options(const std::string& path, Handler handler) {
-    add_route("OPTIONS", path, std::move(handler));
+void HttpRouter::options(const std::string& path, Handler handler, RouteOptions options) {
+    add_route("OPTIONS", path, Route{std::move(handler), {}, options});
+}
+
+void HttpRouter::get(const std::string& path, FillHandler handler, RouteOptions options) {
+    Route route{{}, {}, options};
+    route.fill_handler = std::move(handler);
+    add_route("GET", path, std::move(route));
+}
+
+void HttpRouter::post(const std::string& path, FillHandler handler, RouteOptions options) {
+    Route route{{}, {}, options};
+    route.fill_handler = std::move(handler);
+    add_route("POST", path, std::move(route));
+}
+
+void HttpRouter::put(const std::string& path, FillHandler handler, RouteOptions options) {
+    Route route{{}, {}, options};
+    route.fill_handler = std::move(handler);
+    add_route("PUT", path, std::move(route));
+}
+
+void HttpRouter::delete_(const std::string& path, FillHandler handler, RouteOptions options) {
+    Route route{{}, {}, options};
+    route.fill_handler = std::move(handler);
+    add_route("DELETE", path, std::move(route));
+}
+
+void HttpRouter::patch(const std::string& path, FillHandler handler, RouteOptions options) {
+    Route route{{}, {}, options};
+    route.fill_handler = std::move(handler);
+    add_route("PATCH", path, std::move(route));
+}
+
+void HttpRouter::options(const std::string& path, FillHandler handler, RouteOptions options) {
+    Route route{{}, {}, options};
+    route.fill_handler = std::move(handler);
+    add_route("OPTIONS", path, std::move(route));
+}
+
+void HttpRouter::get(const std::string& path, StreamHandler handler, RouteOptions options) {
+    add_route("GET", path, Route{{}, std::move(handler), options});
+}
+
+void HttpRouter::post(const std::string& path, StreamHandler handler, RouteOptions options) {
+    add_route("POST", path, Route{{}, std::move(handler), options});
+}
+
+void HttpRouter::put(const std::string& path, StreamHandler handler, RouteOptions options) {
+    add_route("PUT", path, Route{{}, std::move(handler), options});
+}
+
+void HttpRouter::delete_(const std::string& path, StreamHandler handler, RouteOptions options) {
+    add_route("DELETE", path, Route{{}, std::move(handler), options});
+}
+
+void HttpRouter::patch(const std::string& path, StreamHandler handler, RouteOptions options) {
+    add_route("PATCH", path, Route{{}, std::move(handler), options});
+}
+
+void HttpRouter::options(const std::string& path, StreamHandler handler, RouteOptions options) {
+    add_route("OPTIONS", path, Route{{}, std::move(handler), options});
+}
+
+void HttpRouter::static_response(const std::string& method, const std::string& path, const Res& response) {
+    Route route;
+    route.handler = [response](const Req&) { return response; };
+    route.static_response = std::make_shared<const StaticResponse>(response);
+    add_route(method, path, std::move(route));
+}
+
+template <typename Self, typename Visit>
+void HttpRouter::for_each_route(Self& router, Visit&& visit) {
+    for (size_t i = 0; i < method_count; ++i) {
+        std::string method(method_name(static_cast<Method>(i)));
+        for (auto& [path, route] : router.tables_[i].routes) {
+            visit(method, path, route);
+        }
+    }
+    for (auto& [method, table] : router.extension_tables_) {
+        for (auto& [path, route] : table.routes) {
+            visit(method, path, route);
+        }
+    }
 }
 
 void HttpRouter::use(Middleware middleware) {
-    middlewares_.push_back(std::move(middleware));
+    middlewares_.push_back(std::make_shared<const Middleware>(std::move(middleware)));
+    for_each_route(*this, [this](const std::string&, const std::string&, Route& route) { compose(route); });
+}
+
+void HttpRouter::compose(Route& route) const {
+    route.chain.clear();
+    route.chain.reserve(middlewares_.size() + route.scoped.size());
+    for (const auto& middleware : middlewares_) {
+        route.chain.push_back(middleware.get());
+    }
+    for (const auto& middleware : route.scoped) {
+        route.chain.push_back(middleware.get());
+    }
+}
+
+void HttpRouter::Next::operator()() const {
+    if (index_ < route_->chain.size()) {
+        (*route_->chain[index_])(*request_, *response_, Next(*route_, index_ + 1, *request_, *response_, passed_));
+    } else if (passed_) {
+        *passed_ = true;
+    } else if (route_->fill_handler) {
+        route_->fill_handler(*request_, *response_);
+    } else {
+        *response_ = route_->handler(*request_);
+    }
 }
 
 void HttpRouter::group(const std::string& prefix, std::function<void(HttpRouter&)> setup) {
     HttpRouter sub_router;
     setup(sub_router);
 
-    for (const auto& [route_key, handler] : sub_router.routes_) {
-    const std::string& method = route_key.method;
-    const std::string& path = route_key.path;
-    add_route(method, prefix + path, handler);
+    // The group's own middleware becomes scoped to its routes
+    for_each_route(sub_router, [&](const std::string& method, const std::string& path, Route& route) {
+        Route scoped = route;
+        scoped.scoped.insert(scoped.scoped.begin(), sub_router.middlewares_.begin(), sub_router.middlewares_.end());
+        add_route(method, prefix + path, std::move(scoped));
+    });
 }
 
+bool HttpRouter::remove(const std::string& method, const std::string& path) {
+    Method id = parse_method(method);
+    MethodTable* routes = nullptr;
+    if (id != Method::Other) {
+        routes = &tables_[static_cast<size_t>(id)];
+    } else if (auto it = extension_tables_.find(method); it != extension_tables_.end()) {
+        routes = &it->second;
+    }
+    if (!routes || routes->routes.erase(path) == 0) {
+        return false;
+    }
+
+    // The tree cannot drop a path, so it is rebuilt from what is left
+    routes->tree.clear();
+    for (auto& [route_path, route] : routes->routes) {
+        routes->tree.insert(route_path, &route);
+    }
+    return true;
+}
 
+std::unique_ptr<HttpRouter> HttpRouter::clone() const {
+    auto copy = std::make_unique<HttpRouter>();
+    copy->middlewares_ = middlewares_;
+    copy->fixed_ = fixed_;
+    // Added again rather than copied, as the trees point into the tables
+    for_each_route(*this, [&](const std::string& method, const std::string& path, const Route& route) {
+        copy->add_route(method, path, route);
+    });
+    return copy;
 }
 
-Res HttpRouter::handle_request(const Req& request) const {
-    RouteKey key{request.method, request.path};
+const HttpRouter::MethodTable* HttpRouter::table(Method id, std::string_view method) const {
+    if (id != Method::Other) {
+        return &tables_[static_cast<size_t>(id)];
+    }
+    auto it = extension_tables_.find(method);
+    return it != extension_tables_.end() ? &it->second : nullptr;
+}
 
-    auto it = routes_.find(key);
-    if (it != routes_.end()) {
-        return execute_with_middleware(request, it->second);
+FixedHandler HttpRouter::find_fixed(Req& request) const {
+    if (!fixed_) {
+        return nullptr;
+    }
+    request.params.clear();
+    FixedHandler handler = fixed_(request.method, request.path);
+    if (!handler && request.method_id == Method::Head) {
+        handler = fixed_("GET", request.path);
     }
+    return handler;
+}
+
+const HttpRouter::Route* HttpRouter::find(Req& request) const {
+    request.params.clear();
+    const MethodTable* routes = table(request.method_id, request.method);
+    const Route* const* route = routes ? routes->tree.find(request.path, request.params) : nullptr;
 
-    for (const auto& [pattern_key, handler] : routes_) {
-        std::string pattern = pattern_key.method + " " + pattern_key.path;
-        std::string actual = request.method + " " + request.path;
+    // HEAD is GET without the body, unless it has a route of its own
+    if (!route && request.method_id == Method::Head) {
+        request.params.clear();
+        route = tables_[static_cast<size_t>(Method::Get)].tree.find(request.path, request.params);
+    }
+    return route ? *route : nullptr;
+}
 
-        if (matches_pattern(pattern, actual)) {
-            return execute_with_middleware(request, handler);
+std::string HttpRouter::allowed_methods(const Req& request) const {
+    PathParams scratch;
+    std::string allow;
+    auto check = [&](std::string_view method, const MethodTable& table) {
+        scratch.clear();
+        if (table.tree.find(request.path, scratch)) {
+            if (!allow.empty()) allow += ", ";
+            allow += method;
+            return true;
         }
+        return false;
+    };
+
+    bool get = false;
+    bool head = false;
+    for (size_t i = 0; i < method_count; ++i) {
+        bool found = check(method_name(static_cast<Method>(i)), tables_[i]);
+        if (i == static_cast<size_t>(Method::Get)) get = found;
+        if (i == static_cast<size_t>(Method::Head)) head = found;
+    }
+    if (get && !head) {
+        // Answered from GET
+        allow += ", HEAD";
+    }
+    for (const auto& [method, table] : extension_tables_) {
+        check(method, table);
     }
+    return allow;
+}
 
-    return Res::not_found("The requested resource was not found");
+Res HttpRouter::dispatch(const Route* route, const Req& request) const {
+    Res response;
+    dispatch(route, request, response);
+    return response;
 }
 
-void HttpRouter::add_route(const std::string& method, const std::string& path, Handler handler) {
-    routes_[RouteKey{method, path}] = std::move(handler);
+void HttpRouter::dispatch(const Route* route, const Req& request, Res& response) const {
+    if (route && route->stream_handler) {
+        // Only the connection loop can give these a writer
+        response = Res::internal_error("Streaming route dispatched without a connection");
+    } else if (route) {
+        execute_with_middleware(request, *route, response);
+    } else if (std::string allow = allowed_methods(request); !allow.empty()) {
+        response = Res::method_not_allowed(std::move(allow));
+    } else {
+        response = Res::not_found("The requested resource was not found");
+    }
 }
 
-bool HttpRouter::matches_pattern(const std::string& pattern, const std::string& actual) const {
-    if (pattern.find('*') == std::string::npos) {
-        return false;
+bool HttpRouter::admit(const Route& route, const Req& request, Res& response) const {
+    if (route.chain.empty()) return true;
+    bool passed = false;
+    Next(route, 0, request, response, &passed)();
+    return passed;
+}
+
+Res HttpRouter::handle_request(Req& request) const {
+    return dispatch(find(request), request);
+}
+
+void HttpRouter::add_route(const std::string& method, const std::string& path, Route route) {
+    if (route.options.cache.ttl > 0 && (route.handler || route.fill_handler) && !route.cache) {
+        route.cache = std::make_shared<ResponseCache>(route.options.cache);
     }
+    Method id = parse_method(method);
+    MethodTable& table = id != Method::Other ? tables_[static_cast<size_t>(id)] : extension_tables_[method];
 
-    std::string prefix = pattern.substr(0, pattern.find('*'));
-    return actual.length() >= prefix.length() &&
-           actual.substr(0, prefix.length()) == prefix;
+    auto [it, inserted] = table.routes.try_emplace(path);
+    try {
+        table.tree.insert(path, &it->second);
+    } catch (...) {
+        if (inserted) table.routes.erase(it);
+        throw;
+    }
+    it->second = std::move(route);
+    compose(it->second);
 }
 
-Res HttpRouter::execute_with_middleware(const Req& request, const Handler& handler) const {
-    // For now, just execute handler directly
-    // In a full implementation, you'd chain middleware here
-    return handler(request);
+void HttpRouter::execute_with_middleware(const Req& request, const Route& route, Res& response) const {
+    Next(route, 0, request, response)();
 }
 
 }
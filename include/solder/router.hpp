@@ -1,56 +1,186 @@
 #pragma once
+#include "fixed_routes.hpp"
 #include "http_types.hpp"
+#include "response_cache.hpp"
+#include "response_writer.hpp"
+#include "route_tree.hpp"
 #include <functional>
+#include <array>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
 namespace solder {
 
-struct RouteKey {
-    std::string method;
-    std::string path;
+// Hashes std::string and std::string_view alike, so maps keyed by string
+// can be searched with a borrowed view
+struct StringHash {
+    using is_transparent = void;
 
-    bool operator==(const RouteKey& other) const {
-        return method == other.method && path == other.path;
+    std::size_t operator()(std::string_view key) const {
+        return std::hash<std::string_view>{}(key);
     }
 };
 
-struct RouteKeyHash {
-    std::size_t operator()(const RouteKey& key) const {
-        std::size_t h1 = std::hash<std::string>{}(key.method);
-        std::size_t h2 = std::hash<std::string>{}(key.path);
-        return h1 ^ (h2 << 1); // or use boost::hash_combine
-    }
+struct RouteOptions {
+    // Hand the body to the handler through Req::body_reader as it arrives
+    // instead of buffering all of it before the handler runs
+    bool stream_body = false;
+    // Collect the body into pooled fixed-size blocks and hand it over as
+    // Req::body_iov, so large bodies are never made contiguous
+    bool iovector_body = false;
+    // Larger bodies are answered with 413 (iovector_body only)
+    size_t max_body_size = 64 * 1024 * 1024;
+    // Inflate gzip/deflate Content-Encoding before the handler sees the
+    // body, stopping with 413 past max_decoded_size
+    bool decode_body = false;
+    size_t max_decoded_size = 16 * 1024 * 1024;
+    // Reuse serialized 200 answers to GET and HEAD for cache.ttl. Hits
+    // skip middleware, so key on whatever headers gate access. With
+    // compression on, each negotiated coding is cached compressed.
+    CacheOptions cache;
 };
 
 class HttpRouter {
 public:
     using Handler = std::function<Res(const Req&)>;
-    using Middleware = std::function<void(Req&, Res&, std::function<void()>)>;
+    // Fills in a response the connection clears and reuses, so a steady
+    // keep-alive stream of small answers allocates nothing
+    using FillHandler = std::function<void(const Req&, Res&)>;
+    // Writes the response while producing it instead of returning it
+    using StreamHandler = std::function<void(const Req&, ResponseWriter&)>;
+    // Runs the rest of a route's middleware and then its handler; see Next
+    class Next;
+    // Calls next() to go on, or fills the response itself to stop there
+    using Middleware = std::function<void(const Req&, Res&, Next)>;
+
+    struct Route {
+        Handler handler;
+        StreamHandler stream_handler;   // set instead of handler
+        RouteOptions options;
+        // Sent by the connection loop in place of calling handler
+        std::shared_ptr<const StaticResponse> static_response = {};
+        // Set up from options.cache when the route is added
+        std::shared_ptr<ResponseCache> cache = {};
+        FillHandler fill_handler = {};  // set instead of handler
+        // Middleware of the groups the route was added through, outermost
+        // first, and the flat chain composed from it when the route is
+        // added or middleware is used
+        std::vector<std::shared_ptr<const Middleware>> scoped = {};
+        std::vector<const Middleware*> chain = {};
+    };
+
+    // A few pointers and an index, so passing it on allocates nothing.
+    // Call it at most once.
+    class Next {
+    public:
+        void operator()() const;
+
+    private:
+        friend class HttpRouter;
+
+        const Route* route_;
+        size_t index_;
+        const Req* request_;
+        Res* response_;
+        // Set instead of running a handler at the end of the chain (see admit)
+        bool* passed_;
+
+        Next(const Route& route, size_t index, const Req& request, Res& response, bool* passed = nullptr)
+            : route_(&route), index_(index), request_(&request), response_(&response), passed_(passed) {}
+    };
 
     // Route registration methods
-    void get(const std::string& path, Handler handler);
-    void post(const std::string& path, Handler handler);
-    void put(const std::string& path, Handler handler);
-    void delete_(const std::string& path, Handler handler);
-    void patch(const std::string& path, Handler handler);
-    void options(const std::string& path, Handler handler);
-
-    // Middleware support
+    void get(const std::string& path, Handler handler, RouteOptions options = {});
+    void post(const std::string& path, Handler handler, RouteOptions options = {});
+    void put(const std::string& path, Handler handler, RouteOptions options = {});
+    void delete_(const std::string& path, Handler handler, RouteOptions options = {});
+    void patch(const std::string& path, Handler handler, RouteOptions options = {});
+    void options(const std::string& path, Handler handler, RouteOptions options = {});
+
+    void get(const std::string& path, FillHandler handler, RouteOptions options = {});
+    void post(const std::string& path, FillHandler handler, RouteOptions options = {});
+    void put(const std::string& path, FillHandler handler, RouteOptions options = {});
+    void delete_(const std::string& path, FillHandler handler, RouteOptions options = {});
+    void patch(const std::string& path, FillHandler handler, RouteOptions options = {});
+    void options(const std::string& path, FillHandler handler, RouteOptions options = {});
+
+    void get(const std::string& path, StreamHandler handler, RouteOptions options = {});
+    void post(const std::string& path, StreamHandler handler, RouteOptions options = {});
+    void put(const std::string& path, StreamHandler handler, RouteOptions options = {});
+    void delete_(const std::string& path, StreamHandler handler, RouteOptions options = {});
+    void patch(const std::string& path, StreamHandler handler, RouteOptions options = {});
+    void options(const std::string& path, StreamHandler handler, RouteOptions options = {});
+
+    // A fixed response, rendered to wire bytes here and sent as is for
+    // every request (with the current Date) without running any handler
+    void static_response(const std::string& method, const std::string& path, const Res& response);
+
+    // Exact routes compiled into a table (see FixedRoutes), looked up
+    // before the routes registered here
+    using FixedLookup = FixedHandler (*)(std::string_view method, std::string_view path);
+    void set_fixed_routes(FixedLookup lookup) { fixed_ = lookup; }
+    FixedHandler find_fixed(Req& request) const;
+
+    // Runs around every route of this router, in the order added. Before
+    // static and streaming routes it only decides whether they answer (see
+    // admit). Fixed routes and cache hits answer without it.
     void use(Middleware middleware);
 
-    // Route groups
+    // Routes added under `prefix`; middleware the setup uses only runs for
+    // them, inside this router's own
     void group(const std::string& prefix, std::function<void(HttpRouter&)> setup);
 
-    Res handle_request(const Req& request) const;
+    // The route a request would be dispatched to, or nullptr. Fills in
+    // request.params for the route's ":name" and "*name" segments.
+    const Route* find(Req& request) const;
+
+    // Methods the request's path has routes for, as an Allow value, or
+    // empty if it has none
+    std::string allowed_methods(const Req& request) const;
+
+    // Runs a route found earlier; nullptr answers 405 when the path takes
+    // other methods, 404 otherwise
+    Res dispatch(const Route* route, const Req& request) const;
+    // Same, into `response`, which should arrive cleared (see Res::clear)
+    void dispatch(const Route* route, const Req& request, Res& response) const;
+
+    // Runs the middleware of a static or streaming route, which has no
+    // handler for it to wrap. True if it called through to the end;
+    // otherwise it answered in `response`, which goes out instead.
+    bool admit(const Route& route, const Req& request, Res& response) const;
+
+    // find() and dispatch() in one; fills in request.params like find()
+    Res handle_request(Req& request) const;
+
+    // Drops a route; false if there was none. Once the router is serving,
+    // change a copy instead (see HttpServer::update_routes).
+    bool remove(const std::string& method, const std::string& path);
+
+    // A copy with its own route tables, sharing handlers, middleware and
+    // response caches with this one
+    std::unique_ptr<HttpRouter> clone() const;
 
 private:
-    std::unordered_map<RouteKey, Handler, RouteKeyHash> routes_;
-    std::vector<Middleware> middlewares_;
+    struct MethodTable {
+        // By path as registered
+        std::unordered_map<std::string, Route, StringHash, std::equal_to<>> routes;
+        // Points into routes
+        RouteTree<const Route*> tree;
+    };
+
+    std::array<MethodTable, method_count> tables_;
+    // Extension methods, by name
+    std::unordered_map<std::string, MethodTable, StringHash, std::equal_to<>> extension_tables_;
+    std::vector<std::shared_ptr<const Middleware>> middlewares_;
+    FixedLookup fixed_ = nullptr;
 
-    void add_route(const std::string& method, const std::string& path, Handler handler);
-    bool matches_pattern(const std::string& pattern, const std::string& actual) const;
-    Res execute_with_middleware(const Req& request, const Handler& handler) const;
+    void add_route(const std::string& method, const std::string& path, Route route);
+    const MethodTable* table(Method id, std::string_view method) const;
+    void compose(Route& route) const;
+    template <typename Self, typename Visit>
+    static void for_each_route(Self& router, Visit&& visit);
+    void execute_with_middleware(const Req& request, const Route& route, Res& response) const;
 };
 
 }
@@ -0,0 +1,153 @@
+#include "send_queue.hpp"
+#include "file_handle.hpp"
+#include <photon/common/alog.h>
+#include <algorithm>
+#include <climits>
+#include <sys/socket.h>
+
+namespace solder {
+
+bool send_iov(photon::net::ISocketStream* stream, iovec* iov, int count, int flags) {
+    while (count > 0) {
+        ssize_t sent = stream->send(iov, std::min(count, IOV_MAX), flags);
+        if (sent <= 0) {
+            return false;
+        }
+
+        // Skip what went out; a partly sent iovec is resumed where it stopped
+        size_t left = sent;
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+void SendQueue::extend_buffer(size_t start) {
+    // Consecutive heads and small bodies share one iovec
+    if (!segments_.empty() && segments_.back().source == Source::Buffer) {
+        segments_.back().len = buffer_.size() - segments_.back().offset;
+    } else {
+        segments_.push_back({Source::Buffer, 0, start, buffer_.size() - start});
+    }
+}
+
+void SendQueue::push(Res&& response, bool head_only) {
+    size_t start = buffer_.size();
+    if (head_only) {
+        response.append_head_to(buffer_);
+        extend_buffer(start);
+        return;
+    }
+    if (response.has_file()) {
+        response.append_head_to(buffer_);
+        extend_buffer(start);
+        if (response.file_body.length > 0) {
+            segments_.push_back({Source::File, files_.size(), response.file_body.offset, response.file_body.length});
+            files_.push_back(std::move(response.file_body));
+        }
+        return;
+    }
+
+    if (response.body.size() < copy_threshold) {
+        response.append_to(buffer_);
+        extend_buffer(start);
+        return;
+    }
+
+    response.append_head_to(buffer_);
+    extend_buffer(start);
+    segments_.push_back({Source::Body, bodies_.size(), 0, response.body.size()});
+    bodies_.push_back(std::move(response.body));
+}
+
+void SendQueue::push(const StaticResponse& response, bool head_only, std::shared_ptr<const void> owner) {
+    if (owner) {
+        owners_.push_back(std::move(owner));
+    }
+    size_t body = head_only ? response.body_size : 0;
+    if (!response.patch_date) {
+        segments_.push_back({Source::External, 0, 0, response.head.size() - body, response.head.data()});
+        return;
+    }
+    segments_.push_back({Source::External, 0, 0, response.head.size(), response.head.data()});
+
+    // Copied rather than referenced, as the timer rewrites it in place
+    size_t start = buffer_.size();
+    buffer_ += date_header();
+    extend_buffer(start);
+    segments_.push_back({Source::External, 0, 0, response.tail.size() - body, response.tail.data()});
+}
+
+bool SendQueue::flush(photon::net::ISocketStream* stream) {
+    // Memory segments between files go out with one writev each
+    size_t begin = 0;
+    for (size_t i = 0; i < segments_.size(); ++i) {
+        if (segments_[i].source != Source::File) continue;
+        if (!send_memory(stream, begin, i, true) || !send_file(stream, segments_[i])) {
+            return false;
+        }
+        begin = i + 1;
+    }
+    if (!send_memory(stream, begin, segments_.size(), false)) {
+        return false;
+    }
+
+    buffer_.clear();
+    bodies_.clear();
+    owners_.clear();
+    files_.clear();
+    segments_.clear();
+    return true;
+}
+
+bool SendQueue::send_memory(photon::net::ISocketStream* stream, size_t begin, size_t end, bool more) {
+    if (begin == end) return true;
+
+    // Pointers are only taken now, as buffer_ and bodies_ may have moved
+    // while responses were being queued
+    iov_.clear();
+    size_t total = 0;
+    for (size_t i = begin; i < end; ++i) {
+        const Segment& segment = segments_[i];
+        const char* base;
+        switch (segment.source) {
+        case Source::Buffer: base = buffer_.data(); break;
+        case Source::Body: base = bodies_[segment.index].data(); break;
+        default: base = segment.data; break;
+        }
+        iov_.push_back({const_cast<char*>(base) + segment.offset, segment.len});
+        total += segment.len;
+    }
+
+    // With a file to follow, let the kernel put the head in the same packet
+    if (!send_iov(stream, iov_.data(), static_cast<int>(iov_.size()), more ? MSG_MORE : 0)) {
+        LOG_DEBUG("Failed to send complete response of ", total, " bytes");
+        return false;
+    }
+    return true;
+}
+
+bool SendQueue::send_file(photon::net::ISocketStream* stream, const Segment& segment) {
+    int fd = files_[segment.index].handle->fd();
+    size_t offset = segment.offset;
+    size_t left = segment.len;
+    while (left > 0) {
+        ssize_t sent = stream->sendfile(fd, offset, left);
+        if (sent <= 0) {
+            LOG_DEBUG("Failed to sendfile, ", segment.len - left, "/", segment.len, " sent, errno: ", errno);
+            return false;
+        }
+        offset += sent;
+        left -= sent;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "http_types.hpp"
+#include <photon/net/socket.h>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+namespace solder {
+
+// Sends all of `iov`, resuming after partial writes. `iov` is consumed.
+bool send_iov(photon::net::ISocketStream* stream, iovec* iov, int count, int flags = 0);
+
+// Responses waiting to go out on one connection. Heads (and small bodies)
+// are serialized into one buffer, while large bodies stay in the string
+// the handler built and are sent from there with the same writev, so a
+// body is never copied just to put a head in front of it. File bodies go
+// out with sendfile and never pass through user space.
+class SendQueue {
+public:
+    // Smaller bodies are cheaper to copy than to give their own iovec
+    static constexpr size_t copy_threshold = 2048;
+
+    // `head_only` leaves out the body but not its Content-Length, as
+    // answers to HEAD need
+    void push(Res&& response, bool head_only = false);
+    // Sent from where it is, with only the Date line copied; the response
+    // has to stay alive until flush(), which `owner` (if given) ensures
+    void push(const StaticResponse& response, bool head_only = false,
+              std::shared_ptr<const void> owner = {});
+
+    bool empty() const { return segments_.empty(); }
+
+    // Sends everything queued, resuming after partial writes. Returns
+    // false if the connection failed.
+    bool flush(photon::net::ISocketStream* stream);
+
+private:
+    enum class Source {
+        Buffer,
+        Body,       // bodies_[index]
+        File,       // files_[index]
+        External    // data, owned elsewhere
+    };
+
+    struct Segment {
+        Source source;
+        size_t index;
+        size_t offset;
+        size_t len;
+        const char* data = nullptr;
+    };
+
+    std::string buffer_;
+    std::vector<std::string> bodies_;
+    // Keep External data alive until it is sent
+    std::vector<std::shared_ptr<const void>> owners_;
+    std::vector<FileBody> files_;
+    std::vector<Segment> segments_;
+    std::vector<iovec> iov_;
+
+    void extend_buffer(size_t start);
+    bool send_memory(photon::net::ISocketStream* stream, size_t begin, size_t end, bool more);
+    bool send_file(photon::net::ISocketStream* stream, const Segment& segment);
+};
+
+}
@@ -1,29 +1,73 @@
 #include "server.hpp"
+#include "body_reader.hpp"
+#include "rcu.hpp"
+#include "send_queue.hpp"
 #include <photon/common/alog.h>
 #include <photon/net/socket.h>
 #include <photon/photon.h>
+#include <photon/thread/timer.h>
 #include <photon/common/utility.h>
+#include <optional>
 #include <thread>
 #include <iostream>
 
 namespace solder {
 
+namespace {
+
+uint64_t refresh_date(void*) {
+    update_date_header();
+    return 0;
+}
+
+// The 304 instead of a pre-rendered answer the client already holds, or
+// the answer without the ETag it was given when they are off
+const StaticResponse& select_static(const Req& request, const StaticResponse& response, bool etags) {
+    if (!etags) {
+        return response.untagged ? *response.untagged : response;
+    }
+    bool fresh = response.not_modified &&
+                 (request.method_id == Method::Get || request.method_id == Method::Head) &&
+                 etag_matches(request.get_header(Header::IfNoneMatch), response.etag);
+    return fresh ? *response.not_modified : response;
+}
+
+}
+
 HttpServer::HttpServer(const ServerOptions& options)
     : options_(options) {}
 
+HttpServer::~HttpServer() {
+    // Connections hold the server alive, so nothing reads it any more
+    delete router_.exchange(nullptr);
+}
+
 void HttpServer::set_router(std::unique_ptr<HttpRouter> router) {
-    router_ = std::move(router);
+    // No readers before start(), so the old one can go right away
+    delete router_.exchange(router.release());
 }
 
 HttpRouter& HttpServer::router() {
-    if (!router_) {
-        router_ = std::make_unique<HttpRouter>();
+    HttpRouter* current = router_.load();
+    if (!current) {
+        current = new HttpRouter();
+        router_.store(current);
+    }
+    return *current;
+}
+
+void HttpServer::update_routes(const std::function<void(HttpRouter&)>& edit) {
+    SCOPED_LOCK(update_lock_);
+    const HttpRouter* current = router_.load();
+    std::unique_ptr<HttpRouter> next = current ? current->clone() : std::make_unique<HttpRouter>();
+    edit(*next);
+    if (HttpRouter* old = router_.exchange(next.release())) {
+        rcu_retire(old);
     }
-    return *router_;
 }
 
 void HttpServer::start() {
-    if (!router_) {
+    if (!router_.load()) {
         throw std::runtime_error("No router configured");
     }
 
@@ -38,6 +82,9 @@ void HttpServer::start() {
             photon::init(photon::INIT_EVENT_DEFAULT, photon::INIT_IO_NONE);
             DEFER(photon::fini());
 
+            // Keep this worker's Date header current
+            photon::Timer date_timer(1000 * 1000, {nullptr, &refresh_date});
+
             this->multiple();
         });
     }
@@ -103,12 +150,23 @@ void HttpServer::handle_connection(photon::net::ISocketStream* stream) {
         return;
     }
 
+    // Offline while waiting on the client, so idle keep-alive connections
+    // never hold back freeing an old router
+    DEFER(rcu_offline());
+
     try {
         HttpParser parser;
-        std::string recv_buffer(options_.buffer_size, '\0');
+        parser.set_limits(options_.max_request_head, options_.max_request_body);
+        SendQueue queue;
+        std::string decoded_body;
+        // Reused by every request on the connection, keeping their capacity
+        Req request;
+        Res response;
 
         while (true) {
-            ssize_t ret = stream->recv(recv_buffer.data(), recv_buffer.size());
+            // Receive straight into the parser's buffer
+            iovec space = parser.prepare(options_.buffer_size);
+            ssize_t ret = stream->recv(space.iov_base, space.iov_len);
 
             if (ret <= 0) {
                 if (ret == 0) {
@@ -130,46 +188,228 @@ void HttpServer::handle_connection(photon::net::ISocketStream* stream) {
                 break;
             }
 
-            Req request;
-            bool parsed = parser.parse_request(recv_buffer.data(), ret, request);
+            parser.commit(ret);
+
+            rcu_online();
+            const HttpRouter* router = router_.load(std::memory_order_acquire);
+            if (!router) {
+                LOG_ERROR("Router is null in handle_connection");
+                return;
+            }
 
-            if (parsed) {
-                // Check if router is still valid
-                if (!router_) {
-                    LOG_ERROR("Router is null in handle_connection");
+            // Answer every complete request in this round with one send
+            bool close_connection = false;
+            ParseStatus status;
+            while (!close_connection) {
+                status = parser.next(request);
+                if (status != ParseStatus::Complete && status != ParseStatus::Head) {
                     break;
                 }
 
-                Res response;
-                try {
-                    response = router_->handle_request(request);
-                } catch (const std::exception& e) {
-                    LOG_ERROR("Error handling request: ", e.what());
-                    response = Res::internal_error("Internal Server Error");
+                // Fixed routes take buffered bodies only, so they wait for
+                // Complete; until then nothing asks to stream
+                FixedHandler fixed = status == ParseStatus::Complete ? router->find_fixed(request) : nullptr;
+                const HttpRouter::Route* route = fixed ? nullptr : router->find(request);
+                bool stream_body = route && route->options.stream_body;
+                bool iovector_body = route && route->options.iovector_body;
+                bool decode_body = route && route->options.decode_body &&
+                                   request.has_header(Header::ContentEncoding);
+                if (status == ParseStatus::Head && !stream_body && !iovector_body && !decode_body) {
+                    // Keep buffering the body until the request is complete
+                    continue;
                 }
 
-                std::string response_str;
-                response_str.reserve(512 + response.body.size());
-                response.append_to(response_str);
+                std::optional<BodyReader> reader;
+                if (status == ParseStatus::Head) {
+                    // The handler may read for a long time, so earlier
+                    // pipelined answers go out first
+                    if (stream_body && !queue.flush(stream)) return;
+                    reader.emplace(parser, stream);
+                } else if (stream_body || decode_body) {
+                    reader.emplace(request.body);
+                }
 
-                ssize_t sent = stream->send(response_str.data(), response_str.size());
-                if (sent != static_cast<ssize_t>(response_str.size())) {
-                    LOG_DEBUG("Failed to send complete response, sent: ", sent, "/", response_str.size());
-                    break;
+                // A body the handler should not see gets answered here
+                std::optional<Res> rejected;
+                if (decode_body && !reader->decode(request.get_header(Header::ContentEncoding),
+                                                   route->options.max_decoded_size)) {
+                    rejected = Res::unsupported_media_type("Unsupported Content-Encoding");
+                }
+
+                std::optional<BodyChain> chain;
+                if (rejected) {
+                    // Nothing to read
+                } else if (stream_body) {
+                    request.body_reader = &*reader;
+                } else if (iovector_body) {
+                    // A body that arrived whole is only wrapped, not copied
+                    if (reader) {
+                        chain.emplace(route->options.max_body_size);
+                        if (!chain->read_from(*reader)) {
+                            rejected = chain->too_large() ? Res::payload_too_large()
+                                                          : Res::bad_request("Malformed request body");
+                        }
+                    } else if (request.body.size() > route->options.max_body_size) {
+                        rejected = Res::payload_too_large();
+                    } else {
+                        chain.emplace(request.body);
+                    }
+                    if (chain) request.body_iov = &chain->data();
+                } else if (decode_body) {
+                    // Inflated while it arrives, so no extra pass afterwards
+                    if (!reader->read_all(decoded_body)) {
+                        rejected = reader->too_large() ? Res::payload_too_large()
+                                                       : Res::bad_request("Malformed request body");
+                    }
+                    request.body = decoded_body;
+                }
+
+                // Read now, as finishing the body may move the request
+                bool head_only = request.method_id == Method::Head;
+                ContentCoding coding = options_.compression.enabled
+                    ? negotiate_coding(request.get_header(Header::AcceptEncoding))
+                    : ContentCoding::Identity;
+
+                response.clear();
+                // Middleware of routes without a handler for it to wrap
+                // still decides whether they answer
+                bool admitted = true;
+                if (!rejected && route && (route->static_response || route->stream_handler)) {
+                    try {
+                        admitted = router->admit(*route, request, response);
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("Error handling request: ", e.what());
+                        response = Res::internal_error("Internal Server Error");
+                        admitted = false;
+                    }
                 }
 
+                bool answered = false;
+                if (rejected) {
+                    // What is left of the body is not worth draining
+                    response = std::move(*rejected);
+                    close_connection = true;
+                } else if (!admitted) {
+                    // Middleware answered in the route's place
+                } else if (route && route->static_response) {
+                    // Rendered at registration; nothing to build or allocate
+                    queue.push(select_static(request, *route->static_response, options_.etags), head_only);
+                    answered = true;
+                } else if (route && route->stream_handler) {
+                    // Earlier pipelined answers have to go out first
+                    if (!queue.flush(stream)) return;
+                    ResponseWriter writer(stream, request.minor_version >= 1, head_only);
+                    writer.compress_with(coding, options_.compression);
+                    try {
+                        route->stream_handler(request, writer);
+                        writer.end();
+                        answered = true;
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("Error handling request: ", e.what());
+                        // Too late for a proper answer once the head is out
+                        answered = writer.head_sent();
+                        response = Res::internal_error("Internal Server Error");
+                    }
+                    if (answered && !writer.reusable()) {
+                        close_connection = true;
+                    }
+                } else if (fixed) {
+                    try {
+                        fixed(request, response);
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("Error handling request: ", e.what());
+                        response = Res::internal_error("Internal Server Error");
+                    }
+                } else if (route && route->cache) {
+                    // A hit skips the handler and the serializer
+                    std::shared_ptr<const StaticResponse> cached;
+                    try {
+                        // Compressed before it is stored, once per coding
+                        auto compute = [&] {
+                            Res computed = router->dispatch(route, request);
+                            compress_response(computed, coding, options_.compression);
+                            return computed;
+                        };
+                        cached = route->cache->get(request, compute, response,
+                                                   coding == ContentCoding::Identity ? std::string_view{}
+                                                                                     : coding_name(coding),
+                                                   options_.etags);
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("Error handling request: ", e.what());
+                        response = Res::internal_error("Internal Server Error");
+                    }
+                    if (cached) {
+                        // The cache may drop it before the queue is flushed
+                        queue.push(select_static(request, *cached, options_.etags), head_only, cached);
+                        answered = true;
+                    }
+                } else {
+                    try {
+                        router->dispatch(route, request, response);
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("Error handling request: ", e.what());
+                        response = Res::internal_error("Internal Server Error");
+                    }
+                }
+                // Before the request is invalidated below
+                if (!answered && !rejected && options_.etags) {
+                    // Checked on the 200, which may turn into a 304 below
+                    bool varies = options_.compression.enabled &&
+                                  compressible(response, ContentCoding::Gzip, options_.compression);
+                    // Only a body that will be compressed can match a coded tag
+                    if (revalidate(request, response, compressible(response, coding, options_.compression)
+                                                          ? coding_name(coding) : std::string_view{}) &&
+                        varies) {
+                        // Same Vary as the 200 it stands for
+                        vary_on_encoding(response.headers);
+                    }
+                }
+                request.body_reader = nullptr;
+                request.body_iov = nullptr;
+
                 // Check for connection close
-                auto it = request.headers.find("Connection");
                 if (request.minor_version == 0 ||
-                    (it != request.headers.end() && it->second == "close")) {
+                    iequals(request.get_header(Header::Connection), "close")) {
                     LOG_DEBUG("Connection close requested");
-                    break;
+                    close_connection = true;
                 }
-                parser.reset();
-            } else {
+
+                // Skip what the handler left unread; this may move the buffer
+                // the request points into
+                if (reader && !close_connection && !reader->finish()) {
+                    LOG_DEBUG("Request body could not be drained, closing connection");
+                    close_connection = true;
+                }
+
+                if (!answered) {
+                    compress_response(response, coding, options_.compression);
+                    queue.push(std::move(response), head_only);
+                }
+            }
+
+            if (status == ParseStatus::Error) {
+                // Unparseable or oversized, so nothing after it can be trusted
+                Res error = parser.error_status() == 413 ? Res::payload_too_large("Request body too large")
+                          : parser.error_status() == 431 ? Res::header_fields_too_large()
+                          : Res::bad_request("Malformed request");
+                error.headers.set("Connection", "close");
+                queue.push(std::move(error));
+            }
+
+            // Nothing from this router is referenced past the flush
+            bool sent = queue.flush(stream);
+            rcu_offline();
+            if (!sent) {
+                break;
+            }
+
+            if (status == ParseStatus::Error) {
                 LOG_DEBUG("Failed to parse request, closing connection");
                 break;
             }
+            if (close_connection) {
+                break;
+            }
         }
     } catch (const std::exception& e) {
         LOG_ERROR("Exception in handle_connection: ", e.what());
@@ -1,12 +1,16 @@
 
 #pragma once
 
+#include "compression.hpp"
 #include "http_types.hpp"
 #include "router.hpp"
 #include "parser.hpp"
 #include <photon/common/utility.h>
+#include <photon/thread/thread.h>
 #include <photon/thread/thread11.h>
 #include <photon/net/socket.h>
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -18,7 +22,16 @@ struct ServerOptions {
     size_t num_workers = 4;
     size_t buffer_size = 4096;
     bool keep_alive = true;
+    // Past these a request is answered 431 or 413 and the connection closed.
+    // The body limit covers bodies buffered for the handler; streamed ones
+    // go by their route's options.
+    size_t max_request_head = 64 * 1024;
+    size_t max_request_body = 16 * 1024 * 1024;
     std::string server_name = "LampuHTTP/1.0";
+    // gzip/deflate for clients that send Accept-Encoding; off by default
+    CompressionOptions compression;
+    // ETags for 200 answers to GET and HEAD, and 304s for If-None-Match
+    bool etags = true;
 };
 
 class HttpServer: public std::enable_shared_from_this<HttpServer> {
@@ -28,15 +41,28 @@ static std::shared_ptr<HttpServer> create(const ServerOptions& options = {}) {
     }
 
     explicit HttpServer(const ServerOptions& options = {});
+    ~HttpServer();
 
     void start();
 
+    // For setting up routes before start()
     void set_router(std::unique_ptr<HttpRouter> router);
     HttpRouter& router();
 
+    // Changes routes while serving. `edit` gets a copy of the current
+    // router, which replaces it for requests read from then on; requests
+    // already under way finish on the old one, which is freed once every
+    // worker has moved past it. Call from a photon thread, such as a
+    // handler's.
+    void update_routes(const std::function<void(HttpRouter&)>& edit);
+
 private:
     ServerOptions options_;
-    std::unique_ptr<HttpRouter> router_;
+    // Read without a lock: connections load it once per batch of requests
+    // while online (see rcu.hpp) and go offline after sending the answers
+    std::atomic<HttpRouter*> router_{nullptr};
+    // Serializes update_routes; a photon lock, as `edit` may yield
+    photon::mutex update_lock_;
 
 
 void multiple();
@@ -2,5 +2,15 @@
 
 #include "http_types.hpp"
 #include "router.hpp"
+#include "route_tree.hpp"
+#include "fixed_routes.hpp"
 #include "parser.hpp"
+#include "body_reader.hpp"
+#include "multipart.hpp"
+#include "file_handle.hpp"
+#include "send_queue.hpp"
+#include "response_writer.hpp"
+#include "compression.hpp"
+#include "response_cache.hpp"
+#include "rcu.hpp"
 #include "server.hpp"
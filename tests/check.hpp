@@ -0,0 +1,19 @@
+#pragma once
+
+// Minimal test support: each test is a plain executable that ctest runs,
+// failing with a non-zero exit. CHECK stays on in release builds, unlike
+// assert.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+#define CHECK(condition)                                                                \
+    do {                                                                                \
+        if (!(condition)) {                                                             \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            std::exit(1);                                                               \
+        }                                                                               \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) CHECK((actual) == (expected))
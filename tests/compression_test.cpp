@@ -0,0 +1,83 @@
+// Content coding: Accept-Encoding negotiation with q-values, and the Vary
+// every form of a compressible answer carries.
+
+#include "check.hpp"
+#include "solder/compression.hpp"
+#include <string>
+
+using namespace solder;
+
+namespace {
+
+void test_negotiate() {
+    CHECK(negotiate_coding("gzip") == ContentCoding::Gzip);
+    CHECK(negotiate_coding("deflate, gzip") == ContentCoding::Gzip);
+    CHECK(negotiate_coding("gzip;q=0.5, deflate") == ContentCoding::Deflate);
+    CHECK(negotiate_coding("gzip;q=0, deflate;q=0") == ContentCoding::Identity);
+    CHECK(negotiate_coding("*") == ContentCoding::Gzip);
+    CHECK(negotiate_coding("*;q=0, deflate") == ContentCoding::Deflate);
+    CHECK(negotiate_coding("br") == ContentCoding::Identity);
+    CHECK(negotiate_coding("") == ContentCoding::Identity);
+
+    // An empty or malformed q-value refuses the coding
+    CHECK(negotiate_coding("gzip;q=") == ContentCoding::Identity);
+    CHECK(negotiate_coding("gzip;q=x") == ContentCoding::Identity);
+    CHECK(negotiate_coding("gzip;q=, deflate;q=0.1") == ContentCoding::Deflate);
+
+    // Case, spacing, aliases and the three decimals q-values carry
+    CHECK(negotiate_coding("GZIP") == ContentCoding::Gzip);
+    CHECK(negotiate_coding("x-gzip") == ContentCoding::Gzip);
+    CHECK(negotiate_coding(" deflate ;  q=0.8 , gzip ; q=0.5") == ContentCoding::Deflate);
+    CHECK(negotiate_coding("gzip;q=1.0, deflate;q=1") == ContentCoding::Gzip);
+    CHECK(negotiate_coding("gzip;q=0.001") == ContentCoding::Gzip);
+    CHECK(negotiate_coding("gzip;q=0.000") == ContentCoding::Identity);
+    CHECK(negotiate_coding("gzip;q=0.0001") == ContentCoding::Identity);
+    CHECK(negotiate_coding("deflate;q=0.51, gzip;q=0.5") == ContentCoding::Deflate);
+    // A named coding is not overridden by "*"
+    CHECK(negotiate_coding("gzip;q=0, *") == ContentCoding::Deflate);
+    CHECK(negotiate_coding("identity, *;q=0") == ContentCoding::Identity);
+    CHECK(negotiate_coding(",,gzip,") == ContentCoding::Gzip);
+}
+
+void test_vary() {
+    CompressionOptions options;
+    options.enabled = true;
+    std::string big(4000, 'a');
+
+    // Compressed, appended to what the handler varies on
+    Res response = Res::ok(big);
+    response.headers.set("Vary", "Origin");
+    compress_response(response, ContentCoding::Gzip, options);
+    CHECK_EQ(*response.headers.find(Header::ContentEncoding), "gzip");
+    CHECK_EQ(*response.headers.find(Header::Vary), "Origin, Accept-Encoding");
+
+    // Not added twice, in any case
+    response = Res::ok(big);
+    response.headers.set("Vary", "accept-encoding");
+    compress_response(response, ContentCoding::Gzip, options);
+    CHECK_EQ(*response.headers.find(Header::Vary), "accept-encoding");
+
+    // The identity form of a compressible answer varies too
+    response = Res::ok(big);
+    compress_response(response, ContentCoding::Identity, options);
+    CHECK(!response.headers.contains(Header::ContentEncoding));
+    CHECK_EQ(*response.headers.find(Header::Vary), "Accept-Encoding");
+
+    // Nothing for answers that are never compressed, or with it off
+    response = Res::ok("tiny");
+    compress_response(response, ContentCoding::Gzip, options);
+    CHECK(!response.headers.contains(Header::Vary));
+    options.enabled = false;
+    response = Res::ok(big);
+    compress_response(response, ContentCoding::Gzip, options);
+    CHECK(!response.headers.contains(Header::Vary));
+}
+
+}
+
+int main() {
+    test_negotiate();
+    test_vary();
+    std::puts("compression_test passed");
+    return 0;
+}
@@ -0,0 +1,135 @@
+// ETags and 304s: tag format and If-None-Match matching, revalidate() on
+// identity and compressed answers, and pre-rendered static responses.
+
+#include "check.hpp"
+#include "solder/compression.hpp"
+#include <string>
+
+using namespace solder;
+
+namespace {
+
+Req make_get(std::string_view if_none_match = {}) {
+    Req request;
+    request.method = "GET";
+    request.method_id = Method::Get;
+    request.path = "/";
+    if (!if_none_match.empty()) request.headers.add("If-None-Match", if_none_match);
+    return request;
+}
+
+// The tag a compressed answer carries
+std::string coded(const std::string& etag, std::string_view coding) {
+    return etag.substr(0, etag.size() - 1) + "-" + std::string(coding) + "\"";
+}
+
+void test_matching() {
+    std::string etag = make_etag("hello");
+    CHECK(etag.size() > 2 && etag.front() == '"' && etag.back() == '"');
+    CHECK_EQ(etag, make_etag("hello"));
+    CHECK(etag != make_etag("hellp"));
+
+    CHECK(etag_matches(etag, etag));
+    CHECK(etag_matches("W/" + etag, etag));
+    CHECK(etag_matches("\"other\", " + etag, etag));
+    CHECK(etag_matches("*", etag));
+    CHECK(!etag_matches("\"other\"", etag));
+    CHECK(!etag_matches("", etag));
+}
+
+void test_revalidate() {
+    std::string body = "some body";
+    std::string etag = make_etag(body);
+
+    Res response = Res::ok(body);
+    Req plain = make_get();
+    CHECK(!revalidate(plain, response));
+    CHECK_EQ(*response.headers.find(Header::ETag), etag);
+
+    Req cached = make_get(etag);
+    response = Res::ok(body);
+    CHECK(revalidate(cached, response));
+    CHECK_EQ(response.status_code, 304);
+    CHECK(response.body.empty());
+    CHECK_EQ(*response.headers.find(Header::ETag), etag);
+
+    // Only GET and HEAD, and only 200s
+    Req post = make_get(etag);
+    post.method = "POST";
+    post.method_id = Method::Post;
+    response = Res::ok(body);
+    CHECK(!revalidate(post, response));
+    response = Res::not_found(body);
+    CHECK(!revalidate(cached, response));
+}
+
+void test_compressed_variant() {
+    CompressionOptions options;
+    options.enabled = true;
+
+    // Big enough to be compressed, so the coded tag revalidates
+    std::string big(4000, 'a');
+    Res response = Res::ok(big);
+    CHECK(compressible(response, ContentCoding::Gzip, options));
+    // Requests only borrow their header values
+    std::string big_tag = coded(make_etag(big), "gzip");
+    Req holder = make_get(big_tag);
+    CHECK(revalidate(holder, response, "gzip"));
+    CHECK_EQ(*response.headers.find(Header::ETag), big_tag);
+
+    // And compress_response gives the full answer that same tag
+    response = Res::ok(big);
+    revalidate(make_get(), response);
+    compress_response(response, ContentCoding::Gzip, options);
+    CHECK_EQ(*response.headers.find(Header::ContentEncoding), "gzip");
+    CHECK_EQ(*response.headers.find(Header::ETag), big_tag);
+
+    // Too small to compress: the coded tag names nothing this server sends
+    std::string small = "tiny";
+    response = Res::ok(small);
+    CHECK(!compressible(response, ContentCoding::Gzip, options));
+    std::string small_tag = coded(make_etag(small), "gzip");
+    Req stale = make_get(small_tag);
+    CHECK(!revalidate(stale, response, {}));
+    CHECK_EQ(response.status_code, 200);
+}
+
+void test_static_response() {
+    StaticResponse rendered(Res::ok("static body"));
+    CHECK_EQ(rendered.etag, make_etag("static body"));
+    CHECK(rendered.not_modified != nullptr);
+    CHECK(rendered.not_modified->head.find("304") != std::string::npos);
+    CHECK_EQ(rendered.not_modified->body_size, 0u);
+
+    StaticResponse missing(Res::not_found("nope"));
+    CHECK(missing.not_modified == nullptr);
+
+    // The form servers with ETags off send, without the tag added here
+    auto bytes = [](const StaticResponse& response) { return response.head + response.tail; };
+    CHECK(bytes(rendered).find("ETag") != std::string::npos);
+    CHECK(rendered.untagged != nullptr);
+    CHECK(bytes(*rendered.untagged).find("ETag") == std::string::npos);
+    CHECK(rendered.untagged->etag.empty());
+    CHECK(rendered.untagged->not_modified == nullptr);
+
+    StaticResponse plain(Res::ok("static body"), false);
+    CHECK(plain.etag.empty() && plain.untagged == nullptr);
+
+    // A tag the handler set is its own, and stays
+    Res own = Res::ok("static body");
+    own.headers.set("ETag", "\"v1\"");
+    StaticResponse handler_tagged(own);
+    CHECK_EQ(handler_tagged.etag, "\"v1\"");
+    CHECK(handler_tagged.untagged == nullptr);
+}
+
+}
+
+int main() {
+    test_matching();
+    test_revalidate();
+    test_compressed_variant();
+    test_static_response();
+    std::puts("etag_test passed");
+    return 0;
+}
@@ -0,0 +1,211 @@
+// Request and response plumbing: well-known headers found by slot, query
+// strings walked and decoded in place, response headers inline and
+// spilled, and responses serialized in one pass.
+
+#include "check.hpp"
+#include "solder/http_types.hpp"
+#include <cctype>
+#include <string>
+
+using namespace solder;
+
+namespace {
+
+std::string names(const ResHeaders& headers) {
+    std::string joined;
+    for (const auto& [name, value] : headers) joined += name + "=" + value + ";";
+    return joined;
+}
+
+void test_header_lookup() {
+    // Every well-known name maps back to itself, in any case
+    for (size_t i = 0; i < well_known_headers; ++i) {
+        Header id = static_cast<Header>(i);
+        std::string name(header_name(id));
+        CHECK(lookup_header(name) == id);
+        for (char& c : name) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        CHECK(lookup_header(name) == id);
+    }
+    CHECK(lookup_header("X-Custom") == Header::Other);
+    CHECK(lookup_header("Content-Lengthx") == Header::Other);
+    CHECK(lookup_header("") == Header::Other);
+
+    ReqHeaders headers;
+    headers.add("host", "a");
+    headers.add("X-Trace", "1");
+    headers.add("HOST", "b");
+    headers.add("x-trace", "2");
+    CHECK_EQ(headers.size(), 4u);
+    // The first occurrence, by slot or by name
+    CHECK_EQ(headers.find(Header::Host)->value, "a");
+    CHECK_EQ(headers.find("Host")->value, "a");
+    CHECK_EQ(headers.find("X-TRACE")->value, "1");
+    CHECK(headers.id(2) == Header::Host);
+    CHECK(headers.id(1) == Header::Other);
+    CHECK(headers.find(Header::Cookie) == nullptr);
+    CHECK(headers.find("X-Other") == nullptr);
+
+    headers.clear();
+    CHECK(headers.find(Header::Host) == nullptr);
+}
+
+void test_percent_decode() {
+    std::string scratch;
+    // Nothing encoded: the input itself comes back
+    std::string_view plain = "plain-text";
+    CHECK(percent_decode(plain, scratch).data() == plain.data());
+
+    CHECK_EQ(percent_decode("a%20b+c", scratch), "a b c");
+    CHECK_EQ(percent_decode("%e2%82%AC", scratch), "\xe2\x82\xac");
+    // Escapes that are cut short or not hex stay as they are
+    CHECK_EQ(percent_decode("100%", scratch), "100%");
+    CHECK_EQ(percent_decode("%4", scratch), "%4");
+    CHECK_EQ(percent_decode("%zz%41", scratch), "%zzA");
+
+    char out[16];
+    CHECK_EQ(percent_decode("x%2Fy", out), "x/y");
+}
+
+void test_query_params() {
+    Req request;
+    request.query = "a=1&&b=two%20words&flag&a=2&c%5B%5D=x+y&=empty";
+
+    std::string pairs;
+    for (const QueryParam& param : request.query_params()) {
+        pairs += std::string(param.key) + ":" + std::string(param.value) + ";";
+    }
+    CHECK_EQ(pairs, "a:1;b:two%20words;flag:;a:2;c%5B%5D:x+y;:empty;");
+
+    std::string scratch;
+    // The first of repeated keys, decoded
+    CHECK_EQ(*request.query_param("a", scratch), "1");
+    CHECK_EQ(*request.query_param("b", scratch), "two words");
+    CHECK_EQ(*request.query_param("flag", scratch), "");
+    // Keys are matched decoded too
+    CHECK_EQ(*request.query_param("c[]", scratch), "x y");
+    CHECK(!request.query_param("c%5B%5D", scratch));
+    CHECK(!request.query_param("missing", scratch));
+
+    auto all = request.get_query_params();
+    CHECK_EQ(all["b"], "two words");
+    CHECK_EQ(all["c[]"], "x y");
+
+    request.query = {};
+    CHECK(request.query_params().begin() == request.query_params().end());
+}
+
+void test_res_headers() {
+    ResHeaders headers;
+    headers.set("Content-Type", "text/plain");
+    headers.add("Set-Cookie", "a=1");
+    headers.add("Set-Cookie", "b=2");
+    headers["X-One"] = "1";
+    CHECK_EQ(headers.size(), 4u);
+    CHECK_EQ(*headers.find(Header::ContentType), "text/plain");
+    // Any case, and the first of repeated ones
+    CHECK_EQ(*headers.find("content-type"), "text/plain");
+    CHECK_EQ(*headers.find(Header::SetCookie), "a=1");
+    CHECK_EQ(*headers.find("x-one"), "1");
+
+    // set() replaces in place
+    headers.set("content-type", "text/html");
+    CHECK_EQ(headers.size(), 4u);
+    CHECK_EQ(*headers.find(Header::ContentType), "text/html");
+
+    // Past the inline entries every one moves over, in order
+    for (int i = 2; i <= 6; ++i) {
+        headers.set("X-" + std::to_string(i), std::to_string(i));
+    }
+    headers.set("ETag", "\"t\"");
+    CHECK_EQ(headers.size(), 10u);
+    CHECK_EQ(names(headers),
+             "Content-Type=text/html;Set-Cookie=a=1;Set-Cookie=b=2;X-One=1;"
+             "X-2=2;X-3=3;X-4=4;X-5=5;X-6=6;ETag=\"t\";");
+    CHECK_EQ(*headers.find(Header::ContentType), "text/html");
+    CHECK_EQ(*headers.find(Header::ETag), "\"t\"");
+    CHECK_EQ(*headers.find("X-5"), "5");
+
+    // Erasing drops every one of the name and points the slots anew
+    headers.erase("set-cookie");
+    CHECK_EQ(headers.size(), 8u);
+    CHECK(!headers.contains(Header::SetCookie));
+    CHECK_EQ(*headers.find(Header::ETag), "\"t\"");
+    headers.erase("Content-Type");
+    CHECK(!headers.contains(Header::ContentType));
+    CHECK_EQ(names(headers), "X-One=1;X-2=2;X-3=3;X-4=4;X-5=5;X-6=6;ETag=\"t\";");
+    headers.erase("X-Missing");
+    CHECK_EQ(headers.size(), 7u);
+
+    // A copy has its own entries
+    ResHeaders copy = headers;
+    copy.set("X-2", "changed");
+    CHECK_EQ(*headers.find("X-2"), "2");
+    CHECK_EQ(*copy.find(Header::ETag), "\"t\"");
+
+    // Cleared, then filled inline again
+    headers.clear();
+    CHECK(headers.empty());
+    CHECK(!headers.contains(Header::ETag));
+    headers.set("Vary", "Origin");
+    CHECK_EQ(names(headers), "Vary=Origin;");
+    CHECK_EQ(*headers.find(Header::Vary), "Origin");
+
+    // Erasing inline entries keeps the rest in order
+    ResHeaders small = {{"A", "1"}, {"Location", "/x"}, {"B", "2"}};
+    small.erase("a");
+    CHECK_EQ(names(small), "Location=/x;B=2;");
+    CHECK_EQ(*small.find(Header::Location), "/x");
+}
+
+void test_serialize() {
+    std::string date(date_header());
+    CHECK(date.rfind("Date: ", 0) == 0 && date.size() > 8 && date.substr(date.size() - 2) == "\r\n");
+
+    // Cached status line and the default headers
+    CHECK_EQ(Res::ok("hi").to_string(),
+             "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: keep-alive\r\n"
+             "Server: PicoHTTP/2.0\r\n" + date + "Content-Length: 2\r\n\r\nhi");
+
+    // Headers the handler set replace the defaults, in the order set
+    Res custom = Res::ok("<p>");
+    custom.headers.set("Server", "test");
+    custom.headers.set("Content-Type", "text/html");
+    custom.headers.set("Date", "then");
+    custom.headers.set("Connection", "close");
+    CHECK_EQ(custom.to_string(),
+             "HTTP/1.1 200 OK\r\nServer: test\r\nContent-Type: text/html\r\nDate: then\r\n"
+             "Connection: close\r\nContent-Length: 3\r\n\r\n<p>");
+
+    // A status text of its own is written out instead of the cached line
+    Res teapot{418, "Short And Stout", {{"Content-Type", "text/plain"}}, ""};
+    CHECK(teapot.to_string().rfind("HTTP/1.1 418 Short And Stout\r\n", 0) == 0);
+    Res unknown{599, "Odd", {{"Content-Type", "text/plain"}}, ""};
+    CHECK(unknown.to_string().rfind("HTTP/1.1 599 Odd\r\n", 0) == 0);
+    CHECK_EQ(reason_phrase(404), "Not Found");
+    CHECK_EQ(reason_phrase(599), "Unknown");
+
+    // Nothing describes the body of a 204 or 304
+    std::string none = Res::no_content().to_string();
+    CHECK(none.find("Content-Length") == std::string::npos);
+    CHECK(none.find("Content-Type") == std::string::npos);
+
+    // Heads for bodies framed otherwise leave out Content-Length, and
+    // appending keeps what was there
+    std::string out = "prefix";
+    Res::ok("abc").append_head_to(out, false);
+    CHECK(out.rfind("prefixHTTP/1.1 200 OK\r\n", 0) == 0);
+    CHECK(out.find("Content-Length") == std::string::npos);
+    CHECK(out.size() >= 4 && out.substr(out.size() - 4) == "\r\n\r\n");
+}
+
+}
+
+int main() {
+    test_header_lookup();
+    test_percent_decode();
+    test_query_params();
+    test_res_headers();
+    test_serialize();
+    std::puts("http_types_test passed");
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Streaming multipart parsing: parts fed in pieces of every size, with
+// data that nearly matches the boundary across piece edges.
+
+#include "check.hpp"
+#include "solder/body_reader.hpp"
+#include "solder/multipart.hpp"
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+using namespace solder;
+
+namespace {
+
+struct Collect : PartSink {
+    std::string data;
+    bool finished = false;
+
+    bool write(const char* bytes, size_t len) override {
+        data.append(bytes, len);
+        return true;
+    }
+    bool finish() override {
+        finished = true;
+        return true;
+    }
+};
+
+void test_boundary_parameter() {
+    auto quoted = MultipartParser::boundary("multipart/form-data; boundary=\"----abc\"");
+    CHECK(quoted && *quoted == "----abc");
+    auto bare = MultipartParser::boundary("multipart/form-data; charset=utf-8; boundary=xyz");
+    CHECK(bare && *bare == "xyz");
+    CHECK(!MultipartParser::boundary("application/json"));
+}
+
+// The boundary itself holds CRLF "--", and the data holds prefixes of it
+void test_boundary_carry() {
+    std::string boundary = "xx\r\n--xy";
+    std::string body =
+        "preamble\r\n--" + boundary + "\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\n"
+        "hello\r\n--xx\r\n--x\r\r\n"
+        "\r\n--" + boundary + "\r\nContent-Disposition: form-data; name=\"f\"; filename=\"a\\\"b.txt\"\r\n"
+        "Content-Type: text/plain\r\n\r\n"
+        "\r\n\r\n--xx\r\n--xz"
+        "\r\n--" + boundary + "--\r\nepilogue";
+
+    std::mt19937 rng(1);
+    for (int round = 0; round < 2000; ++round) {
+        std::map<std::string, Collect> parts;
+        std::map<std::string, PartInfo> infos;
+        MultipartParser parser(boundary, [&](const PartInfo& info) {
+            infos[info.name] = info;
+            return &parts[info.name];
+        });
+        size_t max_piece = round == 0 ? body.size() : 1 + round % 13;
+        bool ok = true;
+        for (size_t pos = 0; pos < body.size();) {
+            size_t len = std::min<size_t>(1 + rng() % max_piece, body.size() - pos);
+            ok = parser.feed(body.data() + pos, len) && ok;
+            pos += len;
+        }
+        CHECK(ok);
+        CHECK(parser.done());
+        CHECK_EQ(parts["a"].data, "hello\r\n--xx\r\n--x\r\r\n");
+        CHECK(parts["a"].finished);
+        CHECK_EQ(parts["f"].data, "\r\n\r\n--xx\r\n--xz");
+        CHECK_EQ(infos["f"].filename, "a\"b.txt");
+        CHECK_EQ(infos["f"].content_type, "text/plain");
+    }
+}
+
+// Random parts of bytes drawn mostly from the boundary's own alphabet
+void test_random_bodies() {
+    std::mt19937 rng(7);
+    for (int round = 0; round < 3000; ++round) {
+        std::string boundary = "XyZ" + std::to_string(rng() % 1000);
+        std::map<std::string, std::string> expected;
+        std::string body = rng() % 2 ? "" : "preamble\r\n";
+        int count = 1 + rng() % 4;
+        for (int i = 0; i < count; ++i) {
+            std::string data;
+            int len = rng() % 300;
+            for (int j = 0; j < len; ++j) {
+                switch (rng() % 10) {
+                case 0: data += '\r'; break;
+                case 1: data += '\n'; break;
+                case 2: data += '-'; break;
+                case 3: data += boundary[rng() % boundary.size()]; break;
+                default: data += static_cast<char>('a' + rng() % 26);
+                }
+            }
+            if (rng() % 5 == 0) data += "\r\n--" + boundary.substr(0, rng() % boundary.size());
+            std::string name = "f" + std::to_string(i);
+            expected[name] = data;
+            body += "--" + boundary + "\r\nContent-Disposition: form-data; name=\"" + name + "\"\r\n\r\n" + data + "\r\n";
+        }
+        body += "--" + boundary + "--\r\n";
+
+        std::map<std::string, std::unique_ptr<MemorySink>> sinks;
+        MultipartParser parser(boundary, [&](const PartInfo& info) {
+            auto& sink = sinks[info.name];
+            sink = std::make_unique<MemorySink>(1 << 20);
+            return sink.get();
+        });
+        bool ok = true;
+        for (size_t pos = 0; pos < body.size();) {
+            size_t len = std::min<size_t>(1 + rng() % 17, body.size() - pos);
+            ok = parser.feed(body.data() + pos, len) && ok;
+            pos += len;
+        }
+        CHECK(ok);
+        CHECK(parser.done());
+        CHECK_EQ(sinks.size(), expected.size());
+        for (const auto& [name, data] : expected) {
+            CHECK(sinks.count(name));
+            CHECK_EQ(sinks[name]->data(), data);
+        }
+    }
+}
+
+void test_parse_from_reader() {
+    std::string body = "--b\r\nContent-Disposition: form-data; name=\"x\"\r\n\r\nxyz\r\n--b--";
+    Collect part;
+    MultipartParser parser("b", [&](const PartInfo&) { return &part; });
+    BodyReader reader(body);
+    CHECK(parser.parse(reader));
+    CHECK(parser.done());
+    CHECK_EQ(part.data, "xyz");
+}
+
+void test_malformed() {
+    Collect part;
+    MultipartParser long_head("b", [&](const PartInfo&) { return &part; });
+    MemorySink small(4);
+    MultipartParser full("b", [&](const PartInfo&) { return &small; });
+    std::string body = "--b\r\nContent-Disposition: form-data; name=\"x\"\r\n\r\ntoo long\r\n--b--";
+    CHECK(!full.feed(body.data(), body.size()));
+
+    std::string head(MultipartParser::max_part_head + 10, 'h');
+    std::string oversized = "--b\r\n" + head;
+    CHECK(!long_head.feed(oversized.data(), oversized.size()));
+}
+
+}
+
+int main() {
+    test_boundary_parameter();
+    test_boundary_carry();
+    test_random_bodies();
+    test_parse_from_reader();
+    test_malformed();
+    std::puts("multipart_test passed");
+    return 0;
+}
@@ -0,0 +1,180 @@
+// Request framing: Content-Length and chunked bodies, pipelining, input
+// split at every byte, and the Transfer-Encoding values that are refused.
+
+#include "check.hpp"
+#include "solder/parser.hpp"
+#include <string>
+
+using namespace solder;
+
+namespace {
+
+ParseStatus parse_once(const std::string& input) {
+    HttpParser parser;
+    Req request;
+    parser.feed(input.data(), input.size());
+    return parser.next(request);
+}
+
+// Next status that is not Head, as a caller that buffers bodies sees it
+ParseStatus next_buffered(HttpParser& parser, Req& request) {
+    ParseStatus status;
+    do {
+        status = parser.next(request);
+    } while (status == ParseStatus::Head);
+    return status;
+}
+
+void test_pipelined() {
+    HttpParser parser;
+    Req request;
+    std::string input =
+        "GET /a?x=1 HTTP/1.1\r\nHost: h\r\n\r\n"
+        "POST /b HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+        "GET /c HTTP/1.0\r\n\r\n"
+        "GET /d HT";
+    parser.feed(input.data(), input.size());
+
+    CHECK(parser.next(request) == ParseStatus::Complete);
+    CHECK_EQ(request.path, "/a");
+    CHECK_EQ(request.query, "x=1");
+    CHECK_EQ(request.get_header(Header::Host), "h");
+    CHECK(request.body.empty());
+
+    CHECK(parser.next(request) == ParseStatus::Complete);
+    CHECK_EQ(request.method, "POST");
+    CHECK_EQ(request.body, "hello");
+
+    CHECK(parser.next(request) == ParseStatus::Complete);
+    CHECK_EQ(request.path, "/c");
+    CHECK_EQ(request.minor_version, 0);
+
+    CHECK(parser.next(request) == ParseStatus::Incomplete);
+    std::string rest = "TP/1.1\r\n\r\n";
+    parser.feed(rest.data(), rest.size());
+    CHECK(parser.next(request) == ParseStatus::Complete);
+    CHECK_EQ(request.path, "/d");
+}
+
+void test_split_everywhere() {
+    std::string input =
+        "POST /upload HTTP/1.1\r\nHost: abc\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n6;ext=1\r\n world\r\n0\r\nTrailer: x\r\n\r\n"
+        "GET /next HTTP/1.1\r\n\r\n";
+    for (size_t split = 1; split < input.size(); ++split) {
+        HttpParser parser;
+        Req request;
+        parser.feed(input.data(), split);
+        bool fed = false;
+        auto next = [&] {
+            ParseStatus status = next_buffered(parser, request);
+            if (status == ParseStatus::Incomplete && !fed) {
+                parser.feed(input.data() + split, input.size() - split);
+                fed = true;
+                status = next_buffered(parser, request);
+            }
+            return status;
+        };
+        CHECK(next() == ParseStatus::Complete);
+        CHECK_EQ(request.path, "/upload");
+        CHECK_EQ(request.get_header(Header::Host), "abc");
+        CHECK_EQ(request.body, "hello world");
+        CHECK(next() == ParseStatus::Complete);
+        CHECK_EQ(request.path, "/next");
+    }
+}
+
+void test_large_body() {
+    HttpParser parser;
+    Req request;
+    std::string body(20000, 'x');
+    std::string input = "POST /big HTTP/1.1\r\nContent-Length: 20000\r\n\r\n" + body;
+    parser.feed(input.data(), 100);
+    CHECK(parser.next(request) == ParseStatus::Head);
+    CHECK_EQ(request.path, "/big");
+    for (size_t pos = 100; pos < input.size(); pos += 777) {
+        CHECK(parser.next(request) == ParseStatus::Incomplete);
+        parser.feed(input.data() + pos, std::min<size_t>(777, input.size() - pos));
+    }
+    CHECK(parser.next(request) == ParseStatus::Complete);
+    CHECK_EQ(request.body, body);
+}
+
+void test_transfer_encoding() {
+    auto with = [](const std::string& value) {
+        return "POST / HTTP/1.1\r\nTransfer-Encoding: " + value + "\r\n\r\n0\r\n\r\n";
+    };
+    CHECK(parse_once(with("chunked")) == ParseStatus::Head);
+    CHECK(parse_once(with("Chunked")) == ParseStatus::Head);
+    CHECK(parse_once(with(" chunked\t")) == ParseStatus::Head);
+
+    CHECK(parse_once(with("xchunked")) == ParseStatus::Error);
+    CHECK(parse_once(with("gzip, chunked")) == ParseStatus::Error);
+    CHECK(parse_once(with("chunked, gzip")) == ParseStatus::Error);
+    CHECK(parse_once(with("chunked, chunked")) == ParseStatus::Error);
+    CHECK(parse_once(with("gzip")) == ParseStatus::Error);
+    CHECK(parse_once(with("")) == ParseStatus::Error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nTransfer-Encoding: chunked\r\n\r\n"
+                     "0\r\n\r\n") == ParseStatus::Error);
+}
+
+void test_content_length() {
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\nabc") ==
+          ParseStatus::Error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\n\r\nabc") ==
+          ParseStatus::Error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 3x\r\n\r\nabc") == ParseStatus::Error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n") ==
+          ParseStatus::Error);
+    CHECK(parse_once("POST / HTTP/1.1\r\nContent-Length: 0\r\n\r\n") == ParseStatus::Complete);
+}
+
+}
+
+// Past the limits: 431 for a head that never ends, 413 for a body the
+// caller buffers, whether its length is declared or it arrives chunked
+void test_limits() {
+    HttpParser parser;
+    Req request;
+    parser.set_limits(64, 16);
+    std::string head = "GET / HTTP/1.1\r\nX-Long: " + std::string(100, 'a');
+    parser.feed(head.data(), head.size());
+    CHECK(parser.next(request) == ParseStatus::Error);
+    CHECK_EQ(parser.error_status(), 431);
+
+    parser.reset();
+    std::string declared = "POST / HTTP/1.1\r\nContent-Length: 17\r\n\r\nx";
+    parser.feed(declared.data(), declared.size());
+    CHECK(parser.next(request) == ParseStatus::Head);
+    CHECK(parser.next(request) == ParseStatus::Error);
+    CHECK_EQ(parser.error_status(), 413);
+
+    parser.reset();
+    std::string chunked = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n10\r\n" +
+                          std::string(16, 'x') + "\r\n1\r\nx\r\n";
+    parser.feed(chunked.data(), chunked.size());
+    CHECK(parser.next(request) == ParseStatus::Head);
+    CHECK(parser.next(request) == ParseStatus::Error);
+    CHECK_EQ(parser.error_status(), 413);
+
+    // Up to the limits is fine, and a later error is a plain 400 again
+    parser.reset();
+    std::string fits = "POST / HTTP/1.1\r\nContent-Length: 16\r\n\r\n" + std::string(16, 'x');
+    parser.feed(fits.data(), fits.size());
+    CHECK(parser.next(request) == ParseStatus::Complete);
+    std::string bad = "GET\r\n\r\n";
+    parser.feed(bad.data(), bad.size());
+    CHECK(parser.next(request) == ParseStatus::Error);
+    CHECK_EQ(parser.error_status(), 400);
+}
+
+int main() {
+    test_pipelined();
+    test_split_everywhere();
+    test_large_body();
+    test_transfer_encoding();
+    test_content_length();
+    test_limits();
+    std::puts("parser_test passed");
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Grace periods for lock-free reads, and live route updates built on them.
+// A reader that loaded a pointer before it was swapped must keep the old
+// object until it goes offline, including the first swap ever made and a
+// reader that came online during the grace period just closed.
+
+#include "check.hpp"
+#include "solder/rcu.hpp"
+#include "solder/server.hpp"
+#include <photon/photon.h>
+#include <photon/thread/thread.h>
+#include <atomic>
+#include <thread>
+
+using namespace solder;
+
+namespace {
+
+std::atomic<int> destroyed{0};
+
+struct Snapshot {
+    int version;
+    ~Snapshot() { destroyed.fetch_add(1); }
+};
+
+std::atomic<Snapshot*> current{nullptr};
+
+// Polls `done` for up to a second
+template <typename Done>
+bool wait_for(Done done) {
+    for (int i = 0; i < 1000; ++i) {
+        if (done()) return true;
+        photon::thread_usleep(1000);
+    }
+    return done();
+}
+
+// A reader loads the snapshot while online and holds it for a while; the
+// writer swaps and retires it meanwhile. With `remote`, the reader runs on
+// a vcpu of its own, as connections on other workers do.
+void swap_under_reader(int version, bool remote) {
+    std::atomic<bool> loaded{false};
+    std::atomic<bool> release{false};
+    std::atomic<bool> seen_valid{false};
+
+    auto read = [&] {
+        rcu_online();
+        Snapshot* snapshot = current.load(std::memory_order_acquire);
+        loaded = true;
+        while (!release) photon::thread_usleep(1000);
+        seen_valid = snapshot->version == version;
+        rcu_offline();
+    };
+
+    std::thread worker;
+    if (remote) {
+        worker = std::thread([&] {
+            photon::init(photon::INIT_EVENT_DEFAULT, photon::INIT_IO_NONE);
+            read();
+            photon::fini();
+        });
+    } else {
+        photon::thread_create11(read);
+    }
+
+    CHECK(wait_for([&] { return loaded.load(); }));
+    int before = destroyed;
+    rcu_retire(current.exchange(new Snapshot{version + 1}));
+
+    // The reader still holds the old one
+    photon::thread_usleep(20 * 1000);
+    CHECK_EQ(destroyed.load(), before);
+
+    release = true;
+    CHECK(wait_for([&] { return destroyed.load() == before + 1; }));
+    CHECK(seen_valid);
+    if (worker.joinable()) worker.join();
+}
+
+// An offline reader does not hold the writer up, and a writer that is a
+// reader itself, like a handler calling update_routes, is only waited for
+// until it goes offline
+void offline_readers_do_not_block() {
+    photon::thread_create11([] {
+        rcu_online();
+        rcu_offline();
+    });
+    photon::thread_yield();
+
+    int before = destroyed;
+    rcu_retire(current.exchange(new Snapshot{100}));
+    CHECK(wait_for([&] { return destroyed.load() == before + 1; }));
+
+    rcu_online();
+    before = destroyed;
+    rcu_retire(current.exchange(new Snapshot{101}));
+    photon::thread_usleep(20 * 1000);
+    CHECK_EQ(destroyed.load(), before);
+    rcu_offline();
+    CHECK(wait_for([&] { return destroyed.load() == before + 1; }));
+}
+
+void update_routes_swaps_router() {
+    auto server = make_server();
+    server->router().get("/old", [](const Req&) { return Res::ok("old"); });
+
+    Req request;
+    request.method = "GET";
+    request.method_id = Method::Get;
+    request.path = "/old";
+    const HttpRouter* before = &server->router();
+    CHECK(before->find(request) != nullptr);
+
+    server->update_routes([](HttpRouter& router) {
+        CHECK(router.remove("GET", "/old"));
+        router.get("/new", [](const Req&) { return Res::ok("new"); });
+    });
+
+    HttpRouter& after = server->router();
+    CHECK(&after != before);
+    CHECK(after.find(request) == nullptr);
+    request.path = "/new";
+    CHECK_EQ(after.handle_request(request).body, "new");
+    // Nothing reads the old router, so it goes after one grace period
+    photon::thread_usleep(20 * 1000);
+}
+
+}
+
+int main() {
+    photon::init(photon::INIT_EVENT_DEFAULT, photon::INIT_IO_NONE);
+
+    current = new Snapshot{1};
+    // The first swap ever, then readers seen in the grace period just closed
+    swap_under_reader(1, false);
+    swap_under_reader(2, false);
+    swap_under_reader(3, true);
+    swap_under_reader(4, true);
+    offline_readers_do_not_block();
+    update_routes_swaps_router();
+    delete current.exchange(nullptr);
+
+    photon::fini();
+    std::puts("rcu_test passed");
+    return 0;
+}
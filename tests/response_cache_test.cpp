@@ -0,0 +1,214 @@
+// Cached answers: one computation per key however many requests wait on
+// it, refreshes after the ttl that keep serving the old answer meanwhile,
+// what is kept apart or not cached at all, and dropping idle answers.
+
+#include "check.hpp"
+#include "solder/response_cache.hpp"
+#include <photon/photon.h>
+#include <photon/thread/thread.h>
+#include <photon/thread/thread11.h>
+#include <string>
+
+using namespace solder;
+
+namespace {
+
+std::string body_of(const StaticResponse& response) {
+    const std::string& last = response.patch_date ? response.tail : response.head;
+    return last.substr(last.size() - response.body_size);
+}
+
+Req make_request(std::string_view method, std::string_view path) {
+    Req request;
+    request.method = method;
+    request.method_id = parse_method(method);
+    request.path = path;
+    return request;
+}
+
+void test_hits() {
+    CacheOptions options;
+    options.ttl = 60ull * 1000 * 1000;
+    ResponseCache cache(options);
+
+    int computed = 0;
+    auto compute = [&] { return Res::ok("answer " + std::to_string(++computed)); };
+    Req request = make_request("GET", "/a");
+    Res fresh;
+
+    auto first = cache.get(request, compute, fresh);
+    CHECK(first);
+    CHECK_EQ(body_of(*first), "answer 1");
+    auto second = cache.get(request, compute, fresh);
+    CHECK(second == first);
+    CHECK_EQ(computed, 1);
+    CHECK(cache.size() > 0);
+
+    // Kept apart by path and by variant
+    Req other = make_request("GET", "/b");
+    CHECK_EQ(body_of(*cache.get(other, compute, fresh)), "answer 2");
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh, "gzip")), "answer 3");
+    CHECK(cache.get(request, compute, fresh) == first);
+    CHECK_EQ(computed, 3);
+
+    // Stored with an ETag and its 304, unless the server has them off
+    CHECK(!first->etag.empty() && first->not_modified);
+    Req plain = make_request("GET", "/plain");
+    auto untagged = cache.get(plain, compute, fresh, {}, false);
+    CHECK(untagged->etag.empty() && !untagged->not_modified);
+}
+
+void test_not_cached() {
+    CacheOptions options;
+    options.ttl = 60ull * 1000 * 1000;
+    ResponseCache cache(options);
+    int computed = 0;
+    Res fresh;
+
+    // Only GET and HEAD
+    Req post = make_request("POST", "/a");
+    CHECK(!cache.get(post, [&] { ++computed; return Res::ok("posted"); }, fresh));
+    CHECK_EQ(fresh.body, "posted");
+
+    // Only 200s, which the computing request still gets
+    Req missing = make_request("GET", "/missing");
+    for (int i = 0; i < 2; ++i) {
+        CHECK(!cache.get(missing, [&] { ++computed; return Res::not_found("gone"); }, fresh));
+        CHECK_EQ(fresh.status_code, 404);
+    }
+    CHECK_EQ(computed, 3);
+
+    // Nothing past max_bytes
+    CacheOptions small = options;
+    small.max_bytes = 16;
+    ResponseCache tight(small);
+    Req request = make_request("GET", "/big");
+    CHECK(!tight.get(request, [] { return Res::ok(std::string(100, 'x')); }, fresh));
+    CHECK_EQ(fresh.body.size(), 100u);
+    CHECK_EQ(tight.size(), 0u);
+}
+
+void test_key_fields() {
+    CacheOptions options;
+    options.ttl = 60ull * 1000 * 1000;
+    options.query_params = {"page"};
+    options.headers = {"Accept-Language"};
+    ResponseCache cache(options);
+
+    int computed = 0;
+    auto compute = [&] { return Res::ok(std::to_string(++computed)); };
+    Res fresh;
+
+    Req request = make_request("GET", "/list");
+    request.query = "page=1&noise=1";
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh)), "1");
+    request.query = "noise=2&page=1";
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh)), "1");
+    request.query = "page=2";
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh)), "2");
+    request.headers.add("Accept-Language", "de");
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh)), "3");
+}
+
+// Requests that arrive while the answer is computed wait for it instead of
+// computing it again
+void test_single_flight() {
+    CacheOptions options;
+    options.ttl = 60ull * 1000 * 1000;
+    ResponseCache cache(options);
+
+    int computed = 0;
+    int answered = 0;
+    constexpr int readers = 8;
+    for (int i = 0; i < readers; ++i) {
+        photon::thread_create11([&] {
+            Req request = make_request("GET", "/slow");
+            Res fresh;
+            auto response = cache.get(request, [&] {
+                ++computed;
+                photon::thread_usleep(20 * 1000);
+                return Res::ok("slow");
+            }, fresh);
+            CHECK(response);
+            CHECK_EQ(body_of(*response), "slow");
+            ++answered;
+        });
+    }
+    for (int i = 0; i < 1000 && answered < readers; ++i) {
+        photon::thread_usleep(1000);
+    }
+    CHECK_EQ(answered, readers);
+    CHECK_EQ(computed, 1);
+}
+
+// After the ttl, one request recomputes while the others keep the old answer
+void test_refresh() {
+    CacheOptions options;
+    options.ttl = 20 * 1000;
+    ResponseCache cache(options);
+
+    int computed = 0;
+    Req request = make_request("GET", "/ticker");
+    Res fresh;
+    auto compute = [&] { return Res::ok("v" + std::to_string(++computed)); };
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh)), "v1");
+
+    photon::thread_usleep(40 * 1000);
+
+    bool refreshing = false;
+    bool released = false;
+    photon::thread_create11([&] {
+        Req own = make_request("GET", "/ticker");
+        Res own_fresh;
+        auto response = cache.get(own, [&] {
+            refreshing = true;
+            while (!released) photon::thread_usleep(1000);
+            return Res::ok("v" + std::to_string(++computed));
+        }, own_fresh);
+        CHECK_EQ(body_of(*response), "v2");
+    });
+    for (int i = 0; i < 1000 && !refreshing; ++i) {
+        photon::thread_usleep(1000);
+    }
+    CHECK(refreshing);
+
+    // Served the stale answer, not held up by the refresh
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh)), "v1");
+    released = true;
+    photon::thread_usleep(10 * 1000);
+    CHECK_EQ(body_of(*cache.get(request, compute, fresh)), "v2");
+    CHECK_EQ(computed, 2);
+}
+
+// Answers nobody asked for within a ttl are dropped, which frees their bytes
+void test_sweep() {
+    CacheOptions options;
+    options.ttl = 20 * 1000;
+    ResponseCache cache(options);
+    Res fresh;
+
+    Req first = make_request("GET", "/first");
+    cache.get(first, [] { return Res::ok("a"); }, fresh);
+    size_t one = cache.size();
+    CHECK(one > 0);
+
+    photon::thread_usleep(50 * 1000);
+    Req second = make_request("GET", "/second");
+    cache.get(second, [] { return Res::ok("b"); }, fresh);
+    CHECK_EQ(cache.size(), one);
+}
+
+}
+
+int main() {
+    photon::init(photon::INIT_EVENT_DEFAULT, photon::INIT_IO_NONE);
+    test_hits();
+    test_not_cached();
+    test_key_fields();
+    test_single_flight();
+    test_refresh();
+    test_sweep();
+    photon::fini();
+    std::puts("response_cache_test passed");
+    return 0;
+}
@@ -0,0 +1,299 @@
+// Route matching: the radix tree's precedence and parameters, the router's
+// per-method tables with 405/Allow and HEAD falling back to GET, groups
+// and middleware, compile-time fixed routes, and copying or trimming a
+// router.
+
+#include "check.hpp"
+#include "solder/route_tree.hpp"
+#include "solder/router.hpp"
+#include <stdexcept>
+#include <string>
+
+using namespace solder;
+
+namespace {
+
+Req make_request(std::string_view method, std::string_view path) {
+    Req request;
+    request.method = method;
+    request.method_id = parse_method(method);
+    request.path = path;
+    return request;
+}
+
+void health(const Req&, Res& response) {
+    response.body = "ok";
+}
+
+using Fixed = FixedRoutes<
+    FixedRoute<"GET", "/health", health>,
+    FixedRoute<"GET", "/version", [](const Req&) { return Res::ok("1.0"); }>,
+    FixedRoute<"POST", "/health", [](const Req&) { return Res::created("posted"); }>,
+    FixedRoute<"PURGE", "/a", [](const Req&) { return Res::ok("purged"); }>>;
+
+void test_tree() {
+    RouteTree<int> tree;
+    tree.insert("/", 1);
+    tree.insert("/users", 2);
+    tree.insert("/users/new", 3);
+    tree.insert("/users/:id", 4);
+    tree.insert("/users/:id/posts/:post", 5);
+    tree.insert("/static/*path", 6);
+    tree.insert("/api/*", 7);
+    tree.insert("/usage", 8);
+    tree.insert("/users/:id/profile", 9);
+    tree.insert("/u", 10);
+
+    PathParams params;
+    auto find = [&](std::string_view path) {
+        params.clear();
+        const int* value = tree.find(path, params);
+        return value ? *value : 0;
+    };
+
+    CHECK_EQ(find("/"), 1);
+    CHECK_EQ(find("/users"), 2);
+    // Static text wins over a parameter
+    CHECK_EQ(find("/users/new"), 3);
+    CHECK_EQ(find("/users/newbie"), 4);
+    CHECK_EQ(params.find("id")->value, "newbie");
+    CHECK_EQ(find("/users/7/posts/9"), 5);
+    CHECK_EQ(params.size(), 2u);
+    CHECK_EQ(params.find("id")->value, "7");
+    CHECK_EQ(params.find("post")->value, "9");
+    CHECK_EQ(find("/users/7/profile"), 9);
+    CHECK_EQ(params.size(), 1u);
+    CHECK_EQ(find("/static/css/a.css"), 6);
+    CHECK_EQ(params.find("path")->value, "css/a.css");
+    CHECK_EQ(find("/static/"), 6);
+    CHECK_EQ(params.find("path")->value, "");
+    CHECK_EQ(find("/api/x/y"), 7);
+    CHECK_EQ(find("/usage"), 8);
+    CHECK_EQ(find("/u"), 10);
+
+    CHECK_EQ(find("/us"), 0);
+    CHECK_EQ(find("/users/"), 0);
+    CHECK_EQ(find("/users/7/posts"), 0);
+    CHECK_EQ(find("/nope"), 0);
+
+    tree.insert("/users/:id", 44);
+    CHECK_EQ(find("/users/1"), 44);
+
+    bool threw = false;
+    try {
+        tree.insert("/users/:name/x", 1);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // A splat takes the rest of the path, so nothing may follow it
+    for (const char* path : {"/a/*/b", "/a/*rest/b", "/a/*rest:id", "/a/**"}) {
+        threw = false;
+        try {
+            tree.insert(path, 1);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+    CHECK_EQ(find("/a/x/b"), 0);
+}
+
+// A parameter that leads nowhere gives way to a splat next to it
+void test_tree_backtracking() {
+    RouteTree<int> tree;
+    tree.insert("/files/:id/meta", 1);
+    tree.insert("/files/*rest", 2);
+
+    PathParams params;
+    CHECK(*tree.find("/files/7/meta", params) == 1);
+    params.clear();
+    CHECK(*tree.find("/files/7/data", params) == 2);
+    CHECK_EQ(params.size(), 1u);
+    CHECK_EQ(params.find("rest")->value, "7/data");
+}
+
+void test_methods() {
+    HttpRouter router;
+    router.get("/users/:id", [](const Req& request) { return Res::ok(std::string(request.param("id"))); });
+    router.post("/users", [](const Req&) { return Res::created(""); });
+    router.static_response("PURGE", "/cache", Res::ok("purged"));
+
+    Req request = make_request("GET", "/users/7");
+    CHECK_EQ(router.handle_request(request).body, "7");
+    CHECK_EQ(request.param("id"), "7");
+
+    // HEAD without a route of its own is answered by GET
+    request = make_request("HEAD", "/users/7");
+    CHECK(router.find(request) != nullptr);
+    CHECK_EQ(request.param("id"), "7");
+
+    request = make_request("DELETE", "/users/7");
+    Res response = router.handle_request(request);
+    CHECK_EQ(response.status_code, 405);
+    CHECK_EQ(*response.headers.find("Allow"), "GET, HEAD");
+
+    request = make_request("GET", "/users");
+    response = router.handle_request(request);
+    CHECK_EQ(response.status_code, 405);
+    CHECK_EQ(*response.headers.find("Allow"), "POST");
+
+    request = make_request("GET", "/cache");
+    response = router.handle_request(request);
+    CHECK_EQ(response.status_code, 405);
+    CHECK_EQ(*response.headers.find("Allow"), "PURGE");
+
+    request = make_request("PURGE", "/cache");
+    const HttpRouter::Route* route = router.find(request);
+    CHECK(route && route->static_response);
+
+    request = make_request("GET", "/nope");
+    CHECK_EQ(router.handle_request(request).status_code, 404);
+}
+
+void test_groups_and_middleware() {
+    std::string trace;
+    HttpRouter router;
+    router.use([&](const Req&, Res&, HttpRouter::Next next) {
+        trace += "outer ";
+        next();
+    });
+    router.group("/v1", [&](HttpRouter& group) {
+        group.use([&](const Req&, Res&, HttpRouter::Next next) {
+            trace += "group ";
+            next();
+        });
+        group.get("/ping", [](const Req&) { return Res::ok("pong"); });
+        group.patch("/ping", [](const Req&, Res& response) { response.body = "patched"; });
+    });
+    router.get("/plain", [](const Req&) { return Res::ok("plain"); });
+
+    Req request = make_request("GET", "/v1/ping");
+    CHECK_EQ(router.handle_request(request).body, "pong");
+    CHECK_EQ(trace, "outer group ");
+
+    trace.clear();
+    request = make_request("PATCH", "/v1/ping");
+    CHECK_EQ(router.handle_request(request).body, "patched");
+    CHECK_EQ(trace, "outer group ");
+
+    // Group middleware stays with the group's routes
+    trace.clear();
+    request = make_request("GET", "/plain");
+    CHECK_EQ(router.handle_request(request).body, "plain");
+    CHECK_EQ(trace, "outer ");
+}
+
+// Static and streaming routes have no handler to wrap, but their middleware
+// still gets to turn a request away
+void test_admit() {
+    HttpRouter router;
+    router.static_response("GET", "/open", Res::ok("open"));
+    router.group("/private", [](HttpRouter& group) {
+        group.use([](const Req& request, Res& response, HttpRouter::Next next) {
+            if (request.has_header("Authorization")) {
+                next();
+            } else {
+                response = Res{401, "Unauthorized", {}, ""};
+            }
+        });
+        group.static_response("GET", "/page", Res::ok("secret"));
+        group.get("/feed", [](const Req&, ResponseWriter&) {});
+    });
+
+    Res response;
+    Req request = make_request("GET", "/open");
+    CHECK(router.admit(*router.find(request), request, response));
+
+    for (const char* path : {"/private/page", "/private/feed"}) {
+        request = make_request("GET", path);
+        const HttpRouter::Route* route = router.find(request);
+        CHECK(route);
+        response.clear();
+        CHECK(!router.admit(*route, request, response));
+        CHECK_EQ(response.status_code, 401);
+
+        request.headers.add("Authorization", "token");
+        response.clear();
+        CHECK(router.admit(*route, request, response));
+    }
+}
+
+void test_fixed_routes() {
+    Res response;
+    Fixed::find("GET", "/health")(make_request("GET", "/health"), response);
+    CHECK_EQ(response.body, "ok");
+    response.clear();
+    Fixed::find("GET", "/version")(make_request("GET", "/version"), response);
+    CHECK_EQ(response.body, "1.0");
+    response.clear();
+    Fixed::find("POST", "/health")(make_request("POST", "/health"), response);
+    CHECK_EQ(response.status_code, 201);
+    CHECK(Fixed::find("PURGE", "/a") != nullptr);
+
+    // Exact matches only
+    CHECK(Fixed::find("GET", "/health/") == nullptr);
+    CHECK(Fixed::find("get", "/health") == nullptr);
+    CHECK(Fixed::find("DELETE", "/health") == nullptr);
+    CHECK(Fixed::find("GET", "/") == nullptr);
+
+    // Looked up first, with HEAD falling back to GET; the rest falls
+    // through to the router's own routes
+    HttpRouter router;
+    router.get("/health", [](const Req&) { return Res::ok("from router"); });
+    router.get("/other", [](const Req&) { return Res::ok("other"); });
+    router.set_fixed_routes(&Fixed::find);
+
+    Req request = make_request("GET", "/health");
+    CHECK(router.find_fixed(request) == Fixed::find("GET", "/health"));
+    request = make_request("HEAD", "/version");
+    CHECK(router.find_fixed(request) == Fixed::find("GET", "/version"));
+    request = make_request("GET", "/other");
+    CHECK(router.find_fixed(request) == nullptr);
+    CHECK_EQ(router.handle_request(request).body, "other");
+}
+
+void test_clone_and_remove() {
+    int calls = 0;
+    HttpRouter router;
+    router.use([&](const Req&, Res&, HttpRouter::Next next) {
+        ++calls;
+        next();
+    });
+    router.get("/a/:id", [](const Req& request) { return Res::ok(std::string(request.param("id"))); });
+    router.get("/b", [](const Req&) { return Res::ok("b"); });
+    router.post("/b", [](const Req&) { return Res::ok("posted"); });
+
+    std::unique_ptr<HttpRouter> copy = router.clone();
+    CHECK(copy->remove("GET", "/b"));
+    CHECK(!copy->remove("GET", "/b"));
+    CHECK(!copy->remove("PURGE", "/b"));
+
+    // The original keeps its route
+    Req request = make_request("GET", "/b");
+    CHECK(router.find(request) != nullptr);
+    CHECK(copy->find(request) == nullptr);
+    Res response = copy->handle_request(request);
+    CHECK_EQ(response.status_code, 405);
+    CHECK_EQ(*response.headers.find("Allow"), "POST");
+
+    // Middleware and the rebuilt tree carry over
+    request = make_request("GET", "/a/7");
+    CHECK_EQ(copy->handle_request(request).body, "7");
+    CHECK_EQ(calls, 1);
+}
+
+}
+
+int main() {
+    test_tree();
+    test_tree_backtracking();
+    test_methods();
+    test_groups_and_middleware();
+    test_admit();
+    test_fixed_routes();
+    test_clone_and_remove();
+    std::puts("router_test passed");
+    return 0;
+}
@@ -0,0 +1,168 @@
+// Queued responses: small bodies copied in with their heads and large ones
+// sent from where they are, writes resumed after the stream takes only
+// part of them, and pre-rendered answers sent with a fresh Date.
+
+#include "check.hpp"
+#include "solder/send_queue.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace solder;
+
+namespace {
+
+// Takes at most `max_write` bytes per call and keeps what it was given
+class FakeStream : public photon::net::ISocketStream {
+public:
+    std::string sent;
+    size_t max_write = SIZE_MAX;
+    // Buffers handed to each send call
+    std::vector<std::vector<iovec>> calls;
+    bool fail = false;
+
+    ssize_t send(const struct iovec* iov, int count, int) override {
+        if (fail) return -1;
+        calls.emplace_back(iov, iov + count);
+        size_t taken = 0;
+        for (int i = 0; i < count && taken < max_write; ++i) {
+            size_t len = std::min(max_write - taken, iov[i].iov_len);
+            sent.append(static_cast<const char*>(iov[i].iov_base), len);
+            taken += len;
+        }
+        return taken;
+    }
+    ssize_t send(const void* data, size_t len, int flags) override {
+        iovec iov{const_cast<void*>(data), len};
+        return send(&iov, 1, flags);
+    }
+    ssize_t sendfile(int fd, off_t offset, size_t count) override {
+        if (fail) return -1;
+        std::string chunk(std::min(count, max_write), '\0');
+        ssize_t got = pread(fd, chunk.data(), chunk.size(), offset);
+        if (got > 0) sent.append(chunk.data(), got);
+        return got;
+    }
+    ssize_t recv(void*, size_t, int) override { return 0; }
+    ssize_t recv(const struct iovec*, int, int) override { return 0; }
+    Object* get_underlay_object(uint64_t) override { return nullptr; }
+    int setsockopt(int, int, const void*, socklen_t) override { return 0; }
+    int getsockopt(int, int, void*, socklen_t*) override { return 0; }
+    int getsockname(photon::net::EndPoint&) override { return 0; }
+    int getpeername(photon::net::EndPoint&) override { return 0; }
+    int getsockname(char*, size_t) override { return 0; }
+    int getpeername(char*, size_t) override { return 0; }
+    int close() override { return 0; }
+    ssize_t read(void*, size_t) override { return 0; }
+    ssize_t readv(const struct iovec*, int) override { return 0; }
+    ssize_t write(const void*, size_t) override { return 0; }
+    ssize_t writev(const struct iovec*, int) override { return 0; }
+};
+
+// The bytes push() should produce for `response`
+std::string wire(Res response) {
+    return response.to_string();
+}
+
+void test_copy_threshold() {
+    FakeStream stream;
+    SendQueue queue;
+
+    // Heads and small bodies share one buffer
+    queue.push(Res::ok("one"));
+    queue.push(Res::ok(std::string(SendQueue::copy_threshold - 1, 's')));
+    Res big = Res::ok(std::string(SendQueue::copy_threshold, 'b'));
+    std::string expected = wire(Res::ok("one")) + wire(Res::ok(std::string(SendQueue::copy_threshold - 1, 's'))) +
+                           wire(big);
+    const char* big_body = big.body.data();
+    queue.push(std::move(big));
+    CHECK(!queue.empty());
+
+    CHECK(queue.flush(&stream));
+    CHECK(queue.empty());
+    CHECK_EQ(stream.sent, expected);
+
+    // One writev: the shared buffer, then the large body from its own string
+    CHECK_EQ(stream.calls.size(), 1u);
+    CHECK_EQ(stream.calls[0].size(), 2u);
+    CHECK(stream.calls[0][1].iov_base == big_body);
+    CHECK_EQ(stream.calls[0][1].iov_len, SendQueue::copy_threshold);
+}
+
+void test_partial_writes() {
+    for (size_t max_write : {1, 7, 100, 4096}) {
+        FakeStream stream;
+        stream.max_write = max_write;
+        SendQueue queue;
+
+        std::string expected;
+        for (size_t size : {5, 3000, 0, 10000}) {
+            Res response = Res::ok(std::string(size, static_cast<char>('a' + size % 26)));
+            expected += wire(response);
+            queue.push(std::move(response));
+        }
+        // HEAD keeps the Content-Length but not the body
+        Res head = Res::ok(std::string(5000, 'h'));
+        std::string full = wire(head);
+        expected += full.substr(0, full.size() - 5000);
+        queue.push(std::move(head), true);
+
+        CHECK(queue.flush(&stream));
+        CHECK_EQ(stream.sent, expected);
+
+        // Reused afterwards, with nothing of the last batch left
+        stream.sent.clear();
+        queue.push(Res::ok("again"));
+        CHECK(queue.flush(&stream));
+        CHECK_EQ(stream.sent, wire(Res::ok("again")));
+    }
+
+    FakeStream broken;
+    broken.fail = true;
+    SendQueue queue;
+    queue.push(Res::ok("lost"));
+    CHECK(!queue.flush(&broken));
+}
+
+void test_static_and_file() {
+    StaticResponse rendered(Res::ok("static body"));
+    CHECK(rendered.patch_date);
+
+    char path[] = "/tmp/send_queue_test_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    std::string contents = "0123456789abcdefghij";
+    CHECK(write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()));
+    ::close(fd);
+
+    for (size_t max_write : {size_t{3}, SIZE_MAX}) {
+        FakeStream stream;
+        stream.max_write = max_write;
+        SendQueue queue;
+        queue.push(rendered);
+        queue.push(rendered, true);
+        Res file = Res::file(path, 5, 10);
+        std::string file_head;
+        file.append_head_to(file_head);
+        queue.push(std::move(file));
+        queue.push(Res::ok("after"));
+        CHECK(queue.flush(&stream));
+
+        std::string bytes = rendered.head + std::string(date_header()) + rendered.tail;
+        std::string head_only = bytes.substr(0, bytes.size() - rendered.body_size);
+        CHECK_EQ(stream.sent, bytes + head_only + file_head + "56789abcde" + wire(Res::ok("after")));
+    }
+    unlink(path);
+}
+
+}
+
+int main() {
+    test_copy_threshold();
+    test_partial_writes();
+    test_static_and_file();
+    std::puts("send_queue_test passed");
+    return 0;
+}